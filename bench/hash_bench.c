@@ -0,0 +1,212 @@
+/*
+ * Cost of each hash implementation bundled with the testcases and patches, so a replacement patch can be chosen
+ * on numbers. Every implementation is compiled from its unchanged source file (see Makefile) and timed on
+ * messages from 9 bytes (GLOBAL_INPUT_LEN, "oakoakoak" of the asserter) to 64 MB:
+ *   oneshot - one call of the project's one-shot function (init/update/final if it has none)
+ *   stream  - init, update in CHUNK-byte pieces, final (as md5sum/sha1sum read files)
+ * For every size the fastest of TRIALS trials is reported, each trial running for at least MIN_TIME seconds.
+ *
+ * Usage: ./hash_bench [-i name] [-m max_bytes] [-c chunk] [-t min_time] [-r trials]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+#include "hash_bench.h"
+
+#define MAX_SIZE	(64UL << 20)
+#define CHUNK		4096
+#define MIN_TIME	0.1
+#define TRIALS		5
+#define MIN_CALLS	3
+
+static const struct hash_impl *impls[] = {
+	&coreutils_md5, &lighttpd_md5, &curl_md5,
+	&coreutils_sha1, &lighttpd_sha1,
+	&patch_sha256,
+};
+
+static const size_t sizes[] = {
+	9, 64, 256, 1024, 4096, 16384, 65536, 1UL << 20, 16UL << 20, 64UL << 20,
+};
+
+/* Large enough for every context struct (the largest is SHA256_CTX, 112 bytes) */
+static union {
+	long double align;
+	unsigned char bytes[1024];
+} ctx;
+
+static size_t chunk = CHUNK;
+static volatile unsigned char sink;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* TSC ticks: reference cycles, not core cycles if the clock scales */
+static uint64_t cycles(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static void oneshot(const struct hash_impl *h, const unsigned char *in, size_t len, unsigned char *out)
+{
+	if (h->oneshot) {
+		h->oneshot(in, len, out);
+		return;
+	}
+	h->init(ctx.bytes);
+	h->update(ctx.bytes, in, len);
+	h->final(ctx.bytes, out);
+}
+
+static void stream(const struct hash_impl *h, const unsigned char *in, size_t len, unsigned char *out)
+{
+	size_t off, n;
+
+	h->init(ctx.bytes);
+	for (off = 0; off < len; off += n) {
+		n = len - off < chunk ? len - off : chunk;
+		h->update(ctx.bytes, in + off, n);
+	}
+	h->final(ctx.bytes, out);
+}
+
+/* Digest of "oakoakoak" by both paths, and agreement of both paths on the whole buffer */
+static int check(const struct hash_impl *h, const unsigned char *buf, size_t len)
+{
+	unsigned char a[64], b[64];
+	char hex[129];
+	size_t i;
+
+	oneshot(h, buf, 9, a);
+	stream(h, buf, 9, b);
+	for (i = 0; i < h->digest_size; i++)
+		sprintf(hex + 2 * i, "%02x", a[i]);
+	if (strcmp(hex, h->oakoakoak) || memcmp(a, b, h->digest_size)) {
+		fprintf(stderr, "%s: wrong digest of oakoakoak: %s\n", h->name, hex);
+		return -1;
+	}
+	oneshot(h, buf, len, a);
+	stream(h, buf, len, b);
+	if (memcmp(a, b, h->digest_size)) {
+		fprintf(stderr, "%s: oneshot and stream digests differ on %zu bytes\n", h->name, len);
+		return -1;
+	}
+	return 0;
+}
+
+struct result {
+	double ns_per_call;
+	double cycles_per_byte;
+};
+
+static struct result measure(const struct hash_impl *h, int streaming, const unsigned char *buf, size_t len,
+			     double min_time, int trials)
+{
+	struct result best = { 0, 0 };
+	unsigned char out[64];
+	int t;
+
+	for (t = 0; t < trials; t++) {
+		double start = now(), elapsed;
+		uint64_t c0 = cycles(), c1;
+		unsigned long calls = 0;
+
+		do {
+			if (streaming)
+				stream(h, buf, len, out);
+			else
+				oneshot(h, buf, len, out);
+			sink ^= out[0];
+			calls++;
+		} while (calls < MIN_CALLS || (elapsed = now() - start) < min_time);
+		c1 = cycles();
+		elapsed = now() - start;
+
+		if (t == 0 || elapsed * 1e9 / calls < best.ns_per_call) {
+			best.ns_per_call = elapsed * 1e9 / calls;
+			best.cycles_per_byte = (double)(c1 - c0) / calls / len;
+		}
+	}
+	return best;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-i name] [-m max_bytes] [-c chunk] [-t min_time] [-r trials]\n", prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	const char *only = NULL;
+	size_t max_size = MAX_SIZE, i, s;
+	double min_time = MIN_TIME;
+	int trials = TRIALS, opt, failed = 0;
+	unsigned char *buf;
+
+	while ((opt = getopt(argc, argv, "i:m:c:t:r:")) != -1) {
+		switch (opt) {
+		case 'i': only = optarg; break;
+		case 'm': max_size = strtoul(optarg, NULL, 0); break;
+		case 'c': chunk = strtoul(optarg, NULL, 0); break;
+		case 't': min_time = atof(optarg); break;
+		case 'r': trials = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (max_size > MAX_SIZE || !chunk || trials < 1)
+		usage(argv[0]);
+
+	/* "oakoakoak" first, so the 9-byte message is the asserter's input; no NUL byte anywhere */
+	buf = malloc(max_size > 9 ? max_size : 9);
+	if (!buf) {
+		perror("malloc");
+		return 1;
+	}
+	memcpy(buf, "oakoakoak", 9);
+	srand(1);
+	for (i = 9; i < max_size; i++)
+		buf[i] = 1 + rand() % 255;
+
+	printf("%-16s %-10s %10s %14s %14s %12s\n", "impl", "mode", "bytes", "ns/call", "cycles/byte", "MB/s");
+	for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+		const struct hash_impl *h = impls[i];
+		int streaming;
+
+		if (only && !strstr(h->name, only))
+			continue;
+		if (check(h, buf, max_size > 9 ? max_size : 9)) {
+			failed = 1;
+			continue;
+		}
+		for (streaming = 0; streaming < 2; streaming++) {
+			for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]) && sizes[s] <= max_size; s++) {
+				struct result r = measure(h, streaming, buf, sizes[s], min_time, trials);
+
+				printf("%-16s %-10s %10zu %14.1f %14.2f %12.1f\n", h->name,
+				       streaming ? "stream" : (h->oneshot ? "oneshot" : "oneshot*"),
+				       sizes[s], r.ns_per_call, r.cycles_per_byte, sizes[s] / r.ns_per_call * 1e3);
+				fflush(stdout);
+			}
+		}
+	}
+	printf("* no one-shot function in this source: init/update/final\n");
+	free(buf);
+	return failed;
+}
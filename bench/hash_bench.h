@@ -0,0 +1,28 @@
+#ifndef HASH_BENCH_H
+#define HASH_BENCH_H
+
+#include <stddef.h>
+
+/* One hash implementation, as its project builds it. Each impl_*.c adapts one project's API to this. */
+struct hash_impl {
+	const char *name;
+	const char *source;		/* file under testcases/ or patch/ */
+	size_t digest_size;
+	const char *oakoakoak;		/* hex digest of "oakoakoak", checked before timing */
+	/* NULL if the project has no one-shot function: init/update/final is timed instead */
+	void (*oneshot)(const unsigned char *in, size_t len, unsigned char *out);
+	void (*init)(void *ctx);
+	void (*update)(void *ctx, const unsigned char *in, size_t len);
+	void (*final)(void *ctx, unsigned char *out);
+};
+
+extern const struct hash_impl coreutils_md5, coreutils_sha1;
+extern const struct hash_impl lighttpd_md5, lighttpd_sha1;
+extern const struct hash_impl curl_md5;
+extern const struct hash_impl patch_sha256;
+
+#define MD5_OAKOAKOAK "acd796382c9e95fb43696ca1c28826fb"
+#define SHA1_OAKOAKOAK "4edeb5f52d94f2be35c61385d3710d0b2e6ffb7a"
+#define SHA256_OAKOAKOAK "602ed9d1bc53fdaea89ae5acdabdf9fb2c3ed3cf0d5fd8207138612e80d45024"
+
+#endif
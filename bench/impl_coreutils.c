@@ -0,0 +1,55 @@
+/* coreutils-5.2.1 lib/md5.c and lib/sha1.c */
+#include <config.h>
+#include "md5.h"
+#include "sha1.h"
+#include "hash_bench.h"
+
+static void md5_oneshot(const unsigned char *in, size_t len, unsigned char *out)
+{
+	md5_buffer((const char *)in, len, out);
+}
+
+static void md5_init(void *ctx)
+{
+	md5_init_ctx(ctx);
+}
+
+static void md5_update(void *ctx, const unsigned char *in, size_t len)
+{
+	md5_process_bytes(in, len, ctx);
+}
+
+static void md5_final(void *ctx, unsigned char *out)
+{
+	md5_finish_ctx(ctx, out);
+}
+
+static void sha1_oneshot(const unsigned char *in, size_t len, unsigned char *out)
+{
+	sha_buffer((const char *)in, len, out);
+}
+
+static void sha1_init(void *ctx)
+{
+	sha_init_ctx(ctx);
+}
+
+static void sha1_update(void *ctx, const unsigned char *in, size_t len)
+{
+	sha_process_bytes(in, len, ctx);
+}
+
+static void sha1_final(void *ctx, unsigned char *out)
+{
+	sha_finish_ctx(ctx, out);
+}
+
+const struct hash_impl coreutils_md5 = {
+	"coreutils md5", "coreutils-5.2.1/lib/md5.c", 16, MD5_OAKOAKOAK,
+	md5_oneshot, md5_init, md5_update, md5_final
+};
+
+const struct hash_impl coreutils_sha1 = {
+	"coreutils sha1", "coreutils-5.2.1/lib/sha1.c", 20, SHA1_OAKOAKOAK,
+	sha1_oneshot, sha1_init, sha1_update, sha1_final
+};
@@ -0,0 +1,30 @@
+/* curl-7.56.0 lib/md5.c, built-in body() variant. Curl_md5it() stops at a NUL byte, so there is no usable
+   one-shot function; MD5_Init/Update/Final are reached through Curl_DIGEST_MD5. */
+#include "curl_setup.h"
+#include <stdlib.h>
+#include "curl_md5.h"
+#include "hash_bench.h"
+
+/* Normally set up by easy.c, which is not linked here */
+curl_malloc_callback Curl_cmalloc = (curl_malloc_callback)malloc;
+curl_free_callback Curl_cfree = (curl_free_callback)free;
+
+static void md5_init(void *ctx)
+{
+	Curl_DIGEST_MD5->md5_init_func(ctx);
+}
+
+static void md5_update(void *ctx, const unsigned char *in, size_t len)
+{
+	Curl_DIGEST_MD5->md5_update_func(ctx, in, (unsigned int)len);
+}
+
+static void md5_final(void *ctx, unsigned char *out)
+{
+	Curl_DIGEST_MD5->md5_final_func(out, ctx);
+}
+
+const struct hash_impl curl_md5 = {
+	"curl md5", "curl-7.56.0/lib/md5.c", 16, MD5_OAKOAKOAK,
+	NULL, md5_init, md5_update, md5_final
+};
@@ -0,0 +1,50 @@
+/* lighttpd-1.4.49 src/md5.c and src/algo_sha1.c (built-in versions, no OpenSSL) */
+#include "first.h"
+#include "md5.h"
+#include "algo_sha1.h"
+#include "hash_bench.h"
+
+static void md5_init(void *ctx)
+{
+	li_MD5_Init(ctx);
+}
+
+static void md5_update(void *ctx, const unsigned char *in, size_t len)
+{
+	li_MD5_Update(ctx, in, (unsigned int)len);
+}
+
+static void md5_final(void *ctx, unsigned char *out)
+{
+	li_MD5_Final(out, ctx);
+}
+
+static void sha1_oneshot(const unsigned char *in, size_t len, unsigned char *out)
+{
+	SHA1(in, len, out);
+}
+
+static void sha1_init(void *ctx)
+{
+	SHA1_Init(ctx);
+}
+
+static void sha1_update(void *ctx, const unsigned char *in, size_t len)
+{
+	SHA1_Update(ctx, in, (unsigned int)len);
+}
+
+static void sha1_final(void *ctx, unsigned char *out)
+{
+	SHA1_Final(out, ctx);
+}
+
+const struct hash_impl lighttpd_md5 = {
+	"lighttpd md5", "lighttpd-1.4.49/src/md5.c", 16, MD5_OAKOAKOAK,
+	NULL, md5_init, md5_update, md5_final
+};
+
+const struct hash_impl lighttpd_sha1 = {
+	"lighttpd sha1", "lighttpd-1.4.49/src/algo_sha1.c", 20, SHA1_OAKOAKOAK,
+	sha1_oneshot, sha1_init, sha1_update, sha1_final
+};
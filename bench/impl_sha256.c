@@ -0,0 +1,28 @@
+/* patch/sha256/sha256.c, the replacement patch. Its main() is renamed at compile time (see Makefile). */
+#include "sha256.h"
+#include "hash_bench.h"
+
+static void oneshot(const unsigned char *in, size_t len, unsigned char *out)
+{
+	sha256(in, len, out);
+}
+
+static void init(void *ctx)
+{
+	sha256_init(ctx);
+}
+
+static void update(void *ctx, const unsigned char *in, size_t len)
+{
+	sha256_update(ctx, in, len);
+}
+
+static void final(void *ctx, unsigned char *out)
+{
+	sha256_final(ctx, out);
+}
+
+const struct hash_impl patch_sha256 = {
+	"patch sha256", "patch/sha256/sha256.c", SHA256_BLOCK_SIZE, SHA256_OAKOAKOAK,
+	oneshot, init, update, final
+};
@@ -7,27 +7,48 @@ from fast_scoper import FastScoper
 from asserter import *
 from angr_caller_analysis import *
 from alice_logger import AliceLog
+from alice_trace import TRACER
+from artifact_store import ArtifactStore, atomic_copy
+from verdict_cache import VerdictCache
+from candidate_ranker import CandidateRanker
+from region_caller_analysis import RegionCallerAnalysis
+from memory_budget import BUDGET
+from taint_mem import mergeAggrMems
+from native_asserter import NativeAsserter, NativeUnavailable
+from digest_classifier import DigestClassifier
 import os
+import sys
+import importlib
 import subprocess
+import threading
 import time
 from taint import *
 from rewriter import *
 from expand_static_buffer import *
 import logging
-import pickle, timeit
+import pickle
 
 Log = AliceLog['main']
-Log.setLevel(logging.DEBUG)
-
-def _handle_timeout(signum, frame):
-    raise TimeoutError('timeout')
 
 # Execute each function w.r.t input/output so that it finds an accurate crypto function
-def search_real_entry(asserter, all_entries, all_argvs, outlen):
+# Verdicts of functions already classified in another binary are taken from ``verdicts" (VerdictCache)
+# If ``ranking" ({entry: CandidateFeatures}) is given, candidates are tried in rank order, and once a signature
+# matched, candidates with a lower score are not tried for it (equal scores still are)
+# With ``prune" (ALICE_RANK_PRUNE=1), candidates are also skipped for signatures with more arguments than they seem
+# to use. Argument inference can undercount, so this can miss entries
+# With ``probe", each candidate is executed once and its signature inferred (CryptoAsserter.probe_signature)
+# instead of being executed once per signature
+def search_real_entry(asserter, all_entries, all_argvs, outlen, crypto=None, verdicts=None, ranking=None, probe=True, prune=False):
     entries = []
     found = set()
+    if ranking is not None:
+        all_entries = sorted([e for e in all_entries if e in ranking], key=lambda e: (-ranking[e].score, e))
+    if probe and set(all_argvs.keys()) == set(PROBED_SIGNATURES):
+        return probe_real_entry(asserter, all_entries, all_argvs, outlen, crypto, verdicts, ranking, prune)
     for arg_name, argv in all_argvs.items():
         Log.info('Function Signature: '+arg_name)
+        out_index = arg_name.split("_").index("out")
+        match_score = None
 
         for entry in all_entries:
 
@@ -35,18 +56,103 @@ def search_real_entry(asserter, all_entries, all_argvs, outlen):
             #if entry in found or entry != 0x46f810:
                 continue
 
-            signal.signal(signal.SIGALRM, _handle_timeout)
-            signal.alarm(20)
+            if ranking is not None:
+                if match_score is not None and ranking[entry].score < match_score:
+                    Log.debug('Early stop for %s at %#x', arg_name, entry)
+                    break
+                if prune and ranking[entry].num_args() < len(argv):
+                    continue
+
+            cached = verdicts.get(entry, crypto, arg_name) if verdicts is not None else None
+            if cached is not None:
+                if cached[0]:
+                    found.add(entry)
+                    entries.append(PatchEntry(entry, arg_name, argv))
+                    if ranking is not None and match_score is None:
+                        match_score = ranking[entry].score
+                continue
+
             try:
-                if asserter.assert_fn(entry, outlen, argv):
+                with TRACER.span('asserter', 'asserter', entry=hex(entry), signature=arg_name):
+                    ok = asserter.assert_fn(entry, outlen, argv)
+                if ok:
                     found.add(entry)
                     entries.append(PatchEntry(entry, arg_name, argv))
+                    if ranking is not None and match_score is None:
+                        match_score = ranking[entry].score
                 else:
-                    Log.debug("Wrong "+hex(entry))
+                    Log.debug("Wrong %#x", entry)
+            except ExecutionTimedOut as e:
+                Log.warning('Fn addr: %#x Timed out: %s, verdict not cached', entry, e)
+                continue
+            except ExecutionAborted as e:
+                Log.debug('Fn addr: %#x Aborted: %s', entry, e)
+                ok = False
+            except Exception as e:
+                # Not a verdict (e.g. an asserter bug or an environment error): not cached, later runs try again
+                Log.warning('Fn addr: ' + hex(entry) + ' Asserter Exception: ' + str(e) + ', verdict not cached')
+                continue
+
+            # Execution is bounded by instruction/block counts, so verdicts are reproducible (timeouts are not cached)
+            if verdicts is not None:
+                verdicts.put(entry, crypto, arg_name, ok, out_index)
+    return entries
+
+PROBED_SIGNATURES = ['in_inlen_out', 'out_in', 'out_in_inlen']
+
+# search_real_entry with one execution per candidate
+def probe_real_entry(asserter, all_entries, all_argvs, outlen, crypto=None, verdicts=None, ranking=None, prune=False):
+    input_arg, inlen_arg, output_arg = all_argvs['in_inlen_out']
+    entries = []
+    match_score = {}
+    for entry in all_entries:
+        names = all_argvs.keys()
+        if ranking is not None:
+            names = [n for n in names if (n not in match_score or ranking[entry].score >= match_score[n])
+                     and (not prune or ranking[entry].num_args() >= len(all_argvs[n]))]
+            if not names:
+                continue
+
+        arg_name = None
+        cached = [verdicts.get(entry, crypto, n) for n in names] if verdicts is not None else [None]
+        if None not in cached:
+            passed = [n for n, v in zip(names, cached) if v[0]]
+            arg_name = passed[0] if passed else None
+        else:
+            try:
+                with TRACER.span('asserter', 'asserter', entry=hex(entry), signature='probe'):
+                    result = asserter.probe_signature(entry, outlen, input_arg.ref_val, inlen_arg.val, output_arg.expected_output)
+            except ExecutionTimedOut as e:
+                Log.warning('Fn addr: %#x Timed out: %s, verdict not cached', entry, e)
+                continue
+            except ExecutionAborted as e:
+                Log.debug('Fn addr: %#x Aborted: %s', entry, e)
+                result = False
             except Exception as e:
-                Log.warning('Fn addr: ' + hex(entry) + ' Asserter Exception: ' + str(e))
-            finally:
-                signal.alarm(0)
+                Log.warning('Fn addr: ' + hex(entry) + ' Asserter Exception: ' + str(e) + ', verdict not cached')
+                continue
+
+            if result is None:
+                # Cannot be probed, execute it once per signature still open for it
+                found = search_real_entry(asserter, [entry], dict([(n, all_argvs[n]) for n in names]), outlen, crypto,
+                                          verdicts, None, probe=False)
+                for pe in found:
+                    if ranking is not None and pe.arg_name not in match_score:
+                        match_score[pe.arg_name] = ranking[entry].score
+                entries += found
+                continue
+            if result:
+                arg_name = result
+            else:
+                Log.debug("Wrong %#x", entry)
+            if verdicts is not None:
+                for n in all_argvs.keys():
+                    verdicts.put(entry, crypto, n, n == arg_name, n.split("_").index("out"))
+
+        if arg_name is not None and arg_name in names:
+            entries.append(PatchEntry(entry, arg_name, all_argvs[arg_name]))
+            if ranking is not None and arg_name not in match_score:
+                match_score[arg_name] = ranking[entry].score
     return entries
 
 # Separate tainted mems into either stack or statically allocated memory
@@ -63,186 +169,425 @@ def separate_tainted_mems(traces, min_cont_size):
     return taint_stack_mems, taint_static_mems
 
 
-# Main Function of Alice
-# Perform detection and replacement of crypto function from binary stored in "path"
-# cryptos contains a list of crypto primitive that wants to be replaced
-# For now, it replaces with SHA256 (from SHA256Patch)
-def process(path, out_dir, cryptos):
-    filename, _ = os.path.splitext(os.path.basename(path))
-    Log.info('Processing file: ' + filename)
-
-    start = time.time()
-    # Setup all modules
-    binary = Binary(path)
-    binary.ca = AngrCallerAnalysis(binary)
-    locator = FastLocator(binary)
-    scoper = FastScoper(binary)
-    patch = SHA256Patch
-    rewriter = Rewriter(path)
-    ebm = ExpandBufferManager(binary, scoper)
-    
-    new_digest_size = patch.crypto.digest_size
-    old_digest_size = cryptos[0].digest_size
-
-
-    ###################### Detection Phase ############################
-    detect_out_name = os.path.join(out_dir, 'detect/' + filename + '.detect')
-
-    try:
-        Log.debug("Try opening file: "+detect_out_name)
-        with open(detect_out_name, "r") as f:
-            c = f.read()
-            if c:
-                patched_entries = pickle.loads(c)
-                for crypto in cryptos:
-                    if crypto in patched_entries:
-                        for pe in patched_entries[crypto]:
-                            Log.debug("Patch at: "+hex(pe.entry)+":"+pe.arg_name)
-                            rewriter.add_patch(NewCryptoPatch(patch, pe.entry, pe.arg_name))
-            else:
-                patched_entries = {}
-
-    except:
-        Log.debug("file doesnt exist")
-        # (1) Generate possbile entries for each primitive
-        possible_entries = {}
-        for crypto in cryptos:
+# ALICE_RANK_PRUNE=1 also drops candidates that seem to take too few arguments (see search_real_entry)
+RANK_PRUNE = os.environ.get('ALICE_RANK_PRUNE') == '1'
+
+# ALICE_ASSERTER=native runs candidates natively (NativeAsserter) instead of emulating them with angr.
+# Falls back to angr for binaries it cannot run (PIE, not executable here)
+ASSERTER_BACKEND = os.environ.get('ALICE_ASSERTER', 'angr')
+
+def make_asserter(binary):
+    if ASSERTER_BACKEND == 'native':
+        try:
+            asserter = NativeAsserter(binary.path)
+            asserter.start()
+            return asserter
+        except (NativeUnavailable, OSError) as e:
+            Log.warning('Native asserter unavailable (' + str(e) + '), using angr')
+    return CryptoAsserter(binary.angr_proj)
+
+# Detection phase: return {crypto: [PatchEntry]}
+def detect(binary, locator, scoper, cryptos, verdicts=None):
+    # (1) Generate possbile entries for each primitive
+    possible_entries = {}
+    transforms = {}
+    for crypto in cryptos:
+        with TRACER.span('locator', 'detect', crypto=crypto.name):
             addrs = locator.get_address_locations(crypto)
-            possible_entries[crypto] = []
+        possible_entries[crypto] = []
+
+        # Functions containing the constants, i.e. the transform (compression) functions
+        transforms[crypto] = set([scoper.get_function_scope(addr)[0] for addr in addrs])
 
+        with TRACER.span('scoper', 'detect', crypto=crypto.name):
             for addr in addrs:
-                Log.debug('Addr: '+hex(addr))
+                Log.debug('Addr: %#x', addr)
                 entries, _ = scoper.get_hierarchical_scopes(addr)
                 possible_entries[crypto] += entries
 
-            possible_entries[crypto] = list(set(possible_entries[crypto]))
-
-        Log.info('Possible Entries: ' + str(possible_entries))
-
-        # (2) Find accurate entry for each primitive
-        asserter = CryptoAsserter(binary.angr_proj)
-        patched_entries = {}
-        for crypto in possible_entries.keys():
-            crypto_name = crypto.name
-            output = crypto.sample_ios[0]['output'].decode("hex")
-            output_len = len(output)
-            test_input = crypto.sample_ios[0]['input']
-            test_input_len = crypto.sample_ios[0]['input-len']
-            all_argvs = generate_all_possible_args(test_input, test_input_len, output)
-            all_entries = list(set(possible_entries[crypto]))
-            if not all_entries:
+        possible_entries[crypto] = list(set(possible_entries[crypto]))
+
+    Log.info('Possible Entries: %s', possible_entries)
+
+    # (2) Find accurate entry for each primitive
+    # Each candidate runs once per signature, its output is checked against the digests of all hash descriptors
+    digest_descs = HashSuiteDesc + [MD4Desc, RIPEMD160Desc] + [c for c in cryptos if c not in HashSuiteDesc + [MD4Desc, RIPEMD160Desc]]
+    backend = make_asserter(binary)
+    if verdicts is not None:
+        verdicts.backend = backend.BACKEND
+    asserter = DigestClassifier(backend, digest_descs)
+    ranker = CandidateRanker(binary)
+    patched_entries = {}
+    for crypto in possible_entries.keys():
+        crypto_name = crypto.name
+        output = crypto.sample_ios[0]['output'].decode("hex")
+        output_len = len(output)
+        test_input = crypto.sample_ios[0]['input']
+        test_input_len = crypto.sample_ios[0]['input-len']
+        all_argvs = generate_all_possible_args(test_input, test_input_len, output)
+        all_entries = list(set(possible_entries[crypto]))
+        if not all_entries:
+            continue
+
+        TRACER.count('candidates', len(all_entries))
+        with TRACER.span('ranker', 'detect', crypto=crypto_name):
+            ranking = ranker.rank(all_entries, transforms[crypto], RANK_PRUNE)
+
+        entries = search_real_entry(asserter, all_entries, all_argvs, output_len, crypto, verdicts, ranking, prune=RANK_PRUNE)
+
+        if not entries:
+            Log.warning('Could not find any valid entry point for ' + crypto_name + ' possibly because it is not used as a one-shot function in this binary')
+            continue
+
+        # Keep track of all functions' entry point, to be replaced/rewritten later
+        for pe in entries:
+            Log.info('Found at: ' + hex(pe.entry) + ' Patch: ' + str(pe.arg_name))
+            if crypto not in patched_entries:
+                patched_entries[crypto] = [pe]
+            else:
+                patched_entries[crypto].append(pe)
+
+    # A candidate executed while searching one primitive may have produced another one's digest
+    for crypto in possible_entries.keys():
+        found = set([pe.entry for pe in patched_entries.get(crypto, [])])
+        all_argvs = generate_all_possible_args(crypto.sample_ios[0]['input'], crypto.sample_ios[0]['input-len'], crypto.sample_ios[0]['output'].decode("hex"))
+        for entry, arg_name in asserter.matched(crypto, all_argvs):
+            if entry not in found:
+                Log.info('Found at: ' + hex(entry) + ' Patch: ' + arg_name + ' (while searching another primitive)')
+                patched_entries.setdefault(crypto, []).append(PatchEntry(entry, arg_name, all_argvs[arg_name]))
+                found.add(entry)
+
+    # Record the verdicts of the other descriptors too, for other binaries
+    if verdicts is not None:
+        for desc in asserter.descs():
+            if desc in possible_entries:
                 continue
+            all_argvs = generate_all_possible_args(desc.sample_ios[0]['input'], desc.sample_ios[0]['input-len'], desc.sample_ios[0]['output'].decode("hex"))
+            matched = set(asserter.matched(desc, all_argvs))
+            for entry, arg_name in asserter.executed(all_argvs):
+                verdicts.put(entry, desc, arg_name, (entry, arg_name) in matched, arg_name.split("_").index("out"))
+    Log.info('Asserter: ' + str(asserter.executions) + ' execution(s) for ' + str(len(possible_entries)) + ' primitive(s)')
+    asserter.close()
+
+    for k, vv in patched_entries.items():
+        for v in vv:
+            Log.info('Entry: %s %#x %s', k, v.entry, v.arg_name)
+    return patched_entries
+
+# A scoping input is either a taint tool command line or a dict:
+#   {'cmdline': ..., 'stdin': file fed to the program, 'replay': shell command run alongside it
+#    (e.g. a request against the server being traced), 'replay_delay': seconds to wait before replaying}
+def _scope_input(scope_input):
+    if isinstance(scope_input, dict):
+        return scope_input
+    return {'cmdline': scope_input}
+
+# Scoping phase: run the taint tool on one input in a private directory, return tainted stack and static mems (AggrMems)
+# or None if the tool did not produce any output
+def run_scoping(run_dir, filename, patched_entries, triton_cmdline):
+    scope_input = _scope_input(triton_cmdline)
+    scope_out_dir = os.path.join(run_dir, 'scope/')
+    if not os.path.exists(scope_out_dir):
+        os.makedirs(scope_out_dir)
 
-            entries = search_real_entry(asserter, all_entries, all_argvs, output_len)
+    with open(scope_out_dir+'patch_entry.out', 'w') as f:
+        f.write(pickle.dumps(patched_entries))
 
-            if not entries:
-                Log.warning('Could not find any valid entry point for ' + crypto_name + ' possibly because it is not used as a one-shot function in this binary')
-                continue
+    with open(scope_out_dir+'fn.out', 'w') as f:
+        f.write(filename)
+
+    print 'Running: ', filename
+    print scope_input['cmdline']
+    for crypto, pes in patched_entries.items():
+        print "Crypto: ", crypto, hex(pes[0].entry), pes[0].arg_name
+
+    # taint_triton_pin.py picks up its input/output directory from ALICE_SCOPE_DIR
+    env = dict(os.environ)
+    env['ALICE_SCOPE_DIR'] = scope_out_dir
+    with TRACER.span('taint', 'scope'):
+        stdin = open(scope_input['stdin']) if scope_input.get('stdin') else None
+        try:
+            proc = subprocess.Popen(scope_input['cmdline'], shell=True, env=env, stdin=stdin)
+            if scope_input.get('replay'):
+                time.sleep(scope_input.get('replay_delay', 5))
+                subprocess.call(scope_input['replay'], shell=True, env=env)
+            proc.wait()
+        finally:
+            if stdin is not None:
+                stdin.close()
+
+    file_name = os.path.join(scope_out_dir, filename + '.scope')
+    if not os.path.exists(file_name):
+        print 'File not exist: ', file_name
+        return None
 
-            # Keep track of all functions' entry point, to be replaced/rewritten later
-            for pe in entries:
-                rewriter.add_patch(NewCryptoPatch(patch, pe.entry, pe.arg_name))
-                Log.info('Found at: ' + hex(pe.entry) + ' Patch: ' + str(pe.arg_name))
-                if crypto not in patched_entries:
-                    patched_entries[crypto] = [pe]
-                else:
-                    patched_entries[crypto].append(pe)
+    with open(file_name) as f:
+        return set(pickle.load(f))
+
+# Run the taint tool on every scoping input concurrently (at most max_parallel at a time), each in
+# its own directory under run_dir, and merge the resulting AggrMems. Conflicts are listed in ``conflicts_path"
+# Inputs with the same command line (or the same 'group' key) run one after the other: a server target such as
+# lighttpd started twice with one config would have both instances bind the same port
+# Returns None if no run produced any output
+def run_scoping_inputs(run_dir, filename, patched_entries, scope_inputs, max_parallel=None, conflicts_path=None):
+    if len(scope_inputs) == 1:
+        return run_scoping(run_dir, filename, patched_entries, scope_inputs[0])
+
+    results = [None] * len(scope_inputs)
+    slots = threading.Semaphore(max_parallel or len(scope_inputs))
+    groups = [_scope_input(s).get('group', _scope_input(s)['cmdline']) for s in scope_inputs]
+    group_locks = dict([(g, threading.Lock()) for g in groups])
+    recording = TRACER.current_recording()
+    def run(i):
+        # Group lock first, so a run waiting for its group does not hold a slot
+        with group_locks[groups[i]], slots, TRACER.recording(recording or TRACER.default):
+            input_dir = os.path.join(run_dir, 'input-%d' % i)
+            try:
+                results[i] = run_scoping(input_dir, filename, patched_entries, scope_inputs[i])
+            except Exception as e:
+                Log.error('Scoping input ' + str(i) + ' failed: ' + str(e))
+
+    with TRACER.span('scope-inputs', 'scope', inputs=len(scope_inputs)):
+        threads = [threading.Thread(target=run, args=(i,)) for i in xrange(len(scope_inputs))]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+
+    mem_sets = dict([(i, mems) for i, mems in enumerate(results) if mems is not None])
+    for i in xrange(len(scope_inputs)):
+        if i not in mem_sets:
+            Log.warning('Scoping input ' + str(i) + ' produced no output: ' + str(_scope_input(scope_inputs[i])['cmdline']))
+    if not mem_sets:
+        return None
+
+    merged, conflicts = mergeAggrMems(mem_sets)
+    if conflicts:
+        with open(conflicts_path or os.path.join(run_dir, 'scope-conflicts.txt'), 'w') as f:
+            for merged_mem, sources in conflicts:
+                line = 'Conflict: ' + str(merged_mem) + ' merged from ' + \
+                       ', '.join(['input ' + str(i) + ': ' + str(mem) for i, mem in sources])
+                Log.warning(line)
+                f.write(line + '\n')
+    Log.info('Scoping: ' + str(len(mem_sets)) + '/' + str(len(scope_inputs)) + ' input(s), ' +
+             str(len(merged)) + ' region(s), ' + str(len(conflicts)) + ' conflict(s)')
+    return set(merged)
 
-        Log.warning('Detection takes: ' + str(time.time()-start))
-        start = time.time()
+# Main Function of Alice
+# Perform detection and replacement of crypto function from binary stored in "path"
+# cryptos contains a list of crypto primitive that wants to be replaced
+# For now, it replaces with SHA256 (from SHA256Patch)
+# A per-phase trace is written to <out_dir>/trace/<filename>.json (Chrome trace format)
+# cfg_mode: 'region' recovers the CFG only around candidate sites (RegionCallerAnalysis), 'full' runs a whole-program CFGFast
+def process(path, out_dir, cryptos, cfg_mode='region'):
+    filename, _ = os.path.splitext(os.path.basename(path))
+    TRACER.reset()
+    try:
+        with TRACER.span('process', file=filename):
+            return _process(path, out_dir, cryptos, cfg_mode)
+    finally:
+        TRACER.log_summary()
+        TRACER.dump_chrome(os.path.join(out_dir, 'trace/' + filename + '.json'))
+        BUDGET.cleanup()
+
+# Settings of one binary, as given by a config module in ./configs (see configs/sha1sum_O0.py)
+class AliceJob:
+
+    # triton_cmdline: one scoping input or a list of them (see run_scoping)
+    def __init__(self, exec_path, cryptos, triton_cmdline, force_insts=None, fns=None):
+        self.exec_path = exec_path
+        self.cryptos = cryptos
+        self.scope_inputs = list(triton_cmdline) if isinstance(triton_cmdline, (list, tuple)) else [triton_cmdline]
+        self.triton_cmdline = self.scope_inputs[0]
+        self.force_insts = force_insts if force_insts is not None else {}
+        self.fns = fns if fns is not None else []
+        self.filename, _ = os.path.splitext(os.path.basename(exec_path))
+
+    @staticmethod
+    def from_config(config_name, config_dir='./configs'):
+        if config_dir not in sys.path:
+            sys.path.insert(0, config_dir)
+        cfg = importlib.import_module(config_name)
+        return AliceJob(cfg.exec_path, cfg.CRYPTO, getattr(cfg, 'scope_inputs', None) or cfg.triton_cmdline,
+                        getattr(cfg, 'force_insts', {}), getattr(cfg, 'fns', []))
+
+    def store(self, out_dir):
+        return ArtifactStore(os.path.join(out_dir, 'artifacts'), self.exec_path, self.cryptos)
+
+    def out_name(self, out_dir):
+        return os.path.join(out_dir, self.filename + '-patched.o')
+
+    # Pruned rankings can find fewer entries, and the native asserter can time out where the emulator does not,
+    # so they get their own key
+    def detect_config(self, cfg_mode):
+        config = {'cfg': cfg_mode}
+        if RANK_PRUNE:
+            config['rank_prune'] = True
+        if ASSERTER_BACKEND == 'native':
+            config['asserter'] = 'native'
+        return config
+
+    # Single-input jobs keep the key they had before scope_inputs existed
+    def scope_config(self):
+        if len(self.scope_inputs) == 1:
+            return {'triton_cmdline': self.triton_cmdline}
+        return {'scope_inputs': self.scope_inputs}
+
+    def rewrite_config(self, patch):
+        config = self.scope_config()
+        # 'scopes': rewritten since function scopes come from the whole-program CFG in both cfg modes
+        config.update({'force_insts': self.force_insts, 'fns': self.fns, 'patch': patch.name, 'scopes': 'full'})
+        return config
+
+
+def load_binary(path, cfg_mode='region'):
+    with TRACER.span('load'):
+        binary = Binary(path)
+    with TRACER.span('cfg', mode=cfg_mode):
+        binary.ca = RegionCallerAnalysis(binary) if cfg_mode == 'region' else AngrCallerAnalysis(binary)
+    return binary
+
+# If the patched binary for this job is in the artifact store, copy it to the output and return True
+def rewrite_up_to_date(job, out_dir, store=None, patch=SHA256Patch):
+    store = store if store is not None else job.store(out_dir)
+    if store.get_file('rewrite', job.out_name(out_dir), job.rewrite_config(patch)):
+        Log.info('Patched binary is up to date: ' + job.out_name(out_dir))
+        return True
+    return False
+
+# The three phases below only depend on their arguments and the artifact store,
+# so they can run in different processes (see pipeline.py)
+
+# Detection phase stage: return {crypto: [PatchEntry]}
+def detect_stage(job, out_dir, cfg_mode='region', binary=None):
+    store = job.store(out_dir)
+    detect_config = job.detect_config(cfg_mode)
+    patched_entries = store.get('detect', detect_config)
+    if patched_entries is None:
+        if binary is None:
+            binary = load_binary(job.exec_path, cfg_mode)
+        with TRACER.span('detect'):
+            verdicts = VerdictCache(os.path.join(out_dir, 'artifacts', 'verdicts'), binary)
+            patched_entries = detect(binary, FastLocator(binary), FastScoper(binary), job.cryptos, verdicts)
+            Log.info('Verdict cache: ' + str(verdicts.hits) + ' hit(s), ' + str(verdicts.misses) + ' miss(es)')
+        store.put('detect', patched_entries, detect_config)
+        BUDGET.report('detect', binary.footprints())
+    return patched_entries
+
+# Scoping phase stage: return tainted stack and static mems, or None if the taint tool did not produce any output
+def scope_stage(job, out_dir, patched_entries, max_parallel=None):
+    store = job.store(out_dir)
+    scope_config = job.scope_config()
+    taint_mems = store.get('scope', scope_config)
+    if taint_mems is None:
+        taint_mems = run_scoping_inputs(store.get_run_dir(), job.filename, patched_entries, job.scope_inputs, max_parallel,
+                                              os.path.join(out_dir, job.filename + '-scope-conflicts.txt'))
+        if taint_mems is None:
+            return None
+        store.put('scope', taint_mems, scope_config)
+        store.release_run_dir()
+    return taint_mems
+
+# Rewriting phase stage: return the path of the patched binary
+def rewrite_stage(job, out_dir, patched_entries, taint_mems, cfg_mode='region', binary=None, patch=SHA256Patch):
+    store = job.store(out_dir)
+    path = job.exec_path
+    force_insts = job.force_insts
+    out_name = job.out_name(out_dir)
+    # Function scopes bound the code that is rewritten (and NOP-filled), so they come from the whole-program CFG
+    # even in region mode: the call-site index can merge functions only reached through jmps or pointers
+    if binary is None:
+        binary = load_binary(path, 'full')
+    elif isinstance(binary.ca, RegionCallerAnalysis):
+        with TRACER.span('cfg', mode='full'):
+            binary.ca = AngrCallerAnalysis(binary)
+    scoper = FastScoper(binary)
+    rewriter = Rewriter(path)
+    ebm = ExpandBufferManager(binary, scoper)
 
-        d = pickle.dumps(patched_entries)
-        pp = pickle.loads(d)
-        for k, vv in pp.items():
-            for v in vv:
-                print k, hex(v.entry), v.arg_name
+    new_digest_size = patch.crypto.digest_size
+    old_digest_size = job.cryptos[0].digest_size
 
-        with open(detect_out_name, "w") as f:
-            f.write(d)
+    for crypto in job.cryptos:
+        if crypto in patched_entries:
+            for pe in patched_entries[crypto]:
+                Log.debug("Patch at: %#x:%s", pe.entry, pe.arg_name)
+                rewriter.add_patch(NewCryptoPatch(patch, pe.entry, pe.arg_name))
+    # The scoping phase returns stack buffers and statically allocated (.bss/.data) ones together
+    taint_stack_mems = set([mem for mem in taint_mems if mem.type == 'Stack'])
+    taint_static_mems = set([mem for mem in taint_mems if mem.type in ('BSS', 'Data')])
+
+    with TRACER.span('rewrite'):
+        # Rewrite based on stack expansion
+        for mem in taint_stack_mems:
+            new_size = (mem.size*new_digest_size)/old_digest_size
+            Log.debug("Force_insts: %s", force_insts)
+            ebm.expand_stack_mem(mem.fn_addr, mem.addr, mem.size, new_size, force_insts)
+            Log.debug('Adjusting stack in fn: ' + hex(mem.fn_addr) + ' offset: ' + hex(mem.addr) + ' from size: ' + hex(mem.size) + '->' + hex(new_size))
+
+        for ff in job.fns:
+            Log.debug("XXXX Force_insts: %s", force_insts)
+            ebm.expand_stack_mem(ff[0], 0, 0, 0, force_insts, ff[1])
+
+
+        # Rewrite based on expansion of statically allocated memory
+        # We move the old location to a new location
+        for mem in taint_static_mems:
+            new_size = (mem.size*new_digest_size)/old_digest_size
+            # Only .data objects carry initial contents, .bss objects are zero-filled by the loader
+            init_data = binary.read_bytes(mem.addr, mem.size) if mem.type == 'Data' else None
+            rewriter.add_patch(NewDataPatch(mem.addr, mem.size, new_size, init_data))
+            ebm.expand_static_mem(binary, mem.addr, mem.size, new_size)
+
+        # Get a mapping from old address to new address from the dummy passes of the rewriter itself,
+        # so the functions rewritten below use the addresses the data is placed at
+        if rewriter.data_patches:
+            for old_addr, new_addr in sorted(rewriter.plan_data().items()):
+                Log.debug('Mapping from old addr: ' + hex(old_addr) + ' to ' + hex(new_addr))
+                ebm.add_data_mapping(old_addr, new_addr)
+
+        # Now rewrite all!
+        rewriter.add_patches(ebm.generate_patches())
+        TRACER.count('patches', len(rewriter.patches))
+        rewriter.apply_patches()
+        footprints = binary.footprints()
+        footprints.update(ebm.footprints())
+        BUDGET.report('rewrite', footprints)
+        ebm.release()
+
+        # Save in the run directory first so out_name is never left half-written
+        tmp_name = os.path.join(store.get_run_dir(), job.filename + '-patched.o')
+        rewriter.save(tmp_name)
+        store.put_file('rewrite', tmp_name, job.rewrite_config(patch))
+        atomic_copy(tmp_name, out_name)
+        store.release_run_dir()
+    return out_name
+
+def _process(path, out_dir, cryptos, cfg_mode='region'):
+    # triton_cmdline (or scope_inputs), force_insts and fns come from the config module imported in __main__
+    job = AliceJob(path, cryptos, globals().get('scope_inputs') or triton_cmdline, force_insts, fns)
+    Log.info('Processing file: ' + job.filename)
+
+    # Every phase output is cached by (binary hash, ALICE version, descriptors, phase config)
+    if rewrite_up_to_date(job, out_dir):
+        return
 
-        #return
+    # Setup all modules
+    binary = load_binary(path, cfg_mode)
 
+    ###################### Detection Phase ############################
+    patched_entries = detect_stage(job, out_dir, cfg_mode, binary)
+    if BUDGET.enabled:
+        # Disassembly, section copies and (in region mode) the angr project are rebuilt on demand if needed
+        binary.release_transient(keep_angr=(cfg_mode == 'full'))
 
     ####################### Scoping Phase ################################
-
-    taint_stack_mems = set()
-    taint_static_mems = set()
-    scope_out_dir = out_dir+'/scope/'
-
-    if not os.path.exists(scope_out_dir):
-        os.makedirs(scope_out_dir)
-    
-    fn = os.path.splitext(os.path.basename(detect_out_name))[0]
-    with open(detect_out_name, 'r') as f:
-        r = f.read()
-        with open(scope_out_dir+'patch_entry.out', 'w') as f2:
-            f2.write(r)
-
-    with open(scope_out_dir+'fn.out', 'w') as f:
-        f.write(fn)
-
-    print 'Running: ', fn
-
-    cmd = 'import os; os.system("'+triton_cmdline+'")'
-
-    print cmd
-    patch_entry = pickle.loads(r)
-    if len(patch_entry.keys()) >= 1:
-        pe = patch_entry[crypto][0]
-        print "Crypto: ", crypto, hex(pe.entry), pe.arg_name
-    t = timeit.timeit(cmd, number=1)
-    Log.warning('Scoping takes: ' + str(t))
-
-    ####################### Rewriting Phase ################################
-
-    tmp_stack_mems = set()
-    file_name = os.path.join(out_dir, 'scope/' + filename + '.scope')
-    if not os.path.exists(file_name):
-        print 'File not exist: ', file_name
+    taint_mems = scope_stage(job, out_dir, patched_entries)
+    if taint_mems is None:
         return
 
-    with open(file_name) as f:
-        tmp_stack_mems = set(pickle.load(f))
-
-    for sm in tmp_stack_mems:
-        taint_stack_mems.add(sm)
-
-    out_name = os.path.join(out_dir, filename + '-patched.o')
-
-    # Rewrite based on stack expansion
-    for mem in taint_stack_mems:
-        new_size = (mem.size*new_digest_size)/old_digest_size
-        Log.debug("Force_insts: "+str(force_insts))
-        ebm.expand_stack_mem(mem.fn_addr, mem.addr, mem.size, new_size, force_insts)
-        Log.debug('Adjusting stack in fn: ' + hex(mem.fn_addr) + ' offset: ' + hex(mem.addr) + ' from size: ' + hex(mem.size) + '->' + hex(new_size))
-        
-    for ff in fns:
-        Log.debug("XXXX Force_insts: "+str(force_insts))
-        ebm.expand_stack_mem(ff[0], 0, 0, 0, force_insts, ff[1])
-
-
-    # Rewrite based on expansion of statically allocated memory
-    # We move the old location to a new location
-    dummy = Rewriter(path)
-    # First try to get a new data mapping by using a dummy rewriter
-    for mem in taint_static_mems:
-        new_size = (mem.size*new_digest_size)/old_digest_size
-        dummy.add_patch(NewDataPatch(mem.addr, mem.size, new_size))
-        rewriter.add_patch(NewDataPatch(mem.addr, mem.size, new_size))
-        ebm.expand_static_mem(binary, mem.addr, mem.size, new_size)
-
-    # Get a mapping from old address to new address
-    dummy.apply_patches()
-    for dp in dummy.data_patches:
-        Log.debug('Mapping from old addr: ' + hex(dp.old_addr) + ' to ' + hex(dp.new_addr))
-        ebm.add_data_mapping(dp.old_addr, dp.new_addr)
-    
-    # Now rewrite all!
-    rewriter.add_patches(ebm.generate_patches())
-    rewriter.apply_patches()
-    rewriter.save(out_name)
-
-    Log.warning('Rewriting takes: ' + str(time.time()-start))
+    ####################### Rewriting Phase ################################
+    rewrite_stage(job, out_dir, patched_entries, taint_mems, cfg_mode, binary)
 
     #return patched_entries, out_name
 
@@ -1,9 +1,12 @@
 import logging
+import os
 
 phases = ['locator', 'scoper', 'rewriter', 'main']
-default_lvl = logging.DEBUG
+# e.g. ALICE_LOG_LEVEL=WARNING; messages below the level are neither formatted nor written
+default_lvl = getattr(logging, os.environ.get('ALICE_LOG_LEVEL', 'DEBUG').upper(), logging.DEBUG)
 
-hdlr = logging.FileHandler('out.log',mode='w')
+# ALICE_LOG_FILE=path chooses where the log goes (default ./out.log)
+hdlr = logging.FileHandler(os.environ.get('ALICE_LOG_FILE', 'out.log'), mode='w')
 formatter = logging.Formatter('%(asctime)s %(levelname)s %(message)s')
 hdlr.setFormatter(formatter)
 hdlr.setLevel(default_lvl)
@@ -0,0 +1,202 @@
+import os
+import json
+import time
+import resource
+import logging
+import threading
+from contextlib import contextmanager
+from functools import wraps
+from alice_logger import AliceLog
+
+Log = AliceLog['main']
+
+# Resource usage of this process plus its waited-for children (e.g. the Pin/Triton scoping run)
+def _usage():
+    s = resource.getrusage(resource.RUSAGE_SELF)
+    c = resource.getrusage(resource.RUSAGE_CHILDREN)
+    return time.time(), s.ru_utime + s.ru_stime + c.ru_utime + c.ru_stime, s.ru_maxrss
+
+PAGE_KB = resource.getpagesize() >> 10
+
+# Current RSS of this process in kB (second field of /proc/self/statm), None where there is no procfs
+def _current_rss_kb():
+    try:
+        with open('/proc/self/statm') as f:
+            return int(f.read().split()[1]) * PAGE_KB
+    except (IOError, IndexError, ValueError):
+        return None
+
+
+class Span:
+
+    def __init__(self, name, cat, args, depth):
+        self.name = name
+        self.cat = cat
+        self.args = args
+        self.depth = depth
+        self.tid = threading.current_thread().ident
+        self.start_wall, self.start_cpu, _ = _usage()
+        self.start_rss_kb = _current_rss_kb()
+        self.wall = None
+        self.cpu = None
+        # ru_maxrss when the span ended: peak RSS of the whole process so far, not a peak within the span
+        self.process_peak_rss_kb = None
+        # Current RSS of the process (/proc/self/statm) when the span ended, and its change since the span began.
+        # Other threads allocate too, so for concurrent spans this is the process' change, not the span's own
+        self.rss_kb = None
+        self.rss_growth_kb = None
+
+    def finish(self):
+        end_wall, end_cpu, end_peak = _usage()
+        self.wall = end_wall - self.start_wall
+        self.cpu = end_cpu - self.start_cpu
+        self.process_peak_rss_kb = end_peak
+        self.rss_kb = _current_rss_kb()
+        if self.rss_kb is not None and self.start_rss_kb is not None:
+            self.rss_growth_kb = self.rss_kb - self.start_rss_kb
+
+    # Spans that did not finish are exported with no duration
+    def to_chrome_event(self, pid):
+        args = dict(self.args)
+        args.update({'cpu_ms': self.cpu*1e3 if self.cpu is not None else None, 'process_peak_rss_kb': self.process_peak_rss_kb,
+                     'rss_kb': self.rss_kb, 'rss_growth_kb': self.rss_growth_kb})
+        return {'name': self.name, 'cat': self.cat, 'ph': 'X', 'pid': pid, 'tid': self.tid,
+                'ts': int(self.start_wall*1e6), 'dur': int(self.wall*1e6) if self.wall is not None else 0, 'args': args}
+
+
+# Spans and counters of one unit of work (a binary, or one pipeline stage of it)
+class Recording:
+
+    def __init__(self):
+        self.spans = []
+        self.counters = {}
+
+
+# Records nested spans (wall time, CPU time, process peak RSS) for each phase of the pipeline
+# Usage:
+#   with TRACER.span('locator', crypto='md5'):
+#       ...
+#   TRACER.dump_chrome('trace.json')   # open with chrome://tracing or Perfetto
+# Spans and counters go to the recording of the current thread (recording()), or to the process-wide one.
+# Stages running concurrently in threads of one process (pipeline.py) each use their own recording
+class Tracer:
+
+    def __init__(self, enabled=True):
+        self.enabled = enabled
+        self.default = Recording()
+        self.lock = threading.Lock()
+        self.local = threading.local()
+
+    def _recording(self):
+        return getattr(self.local, 'recording', None) or self.default
+
+    @property
+    def spans(self):
+        return self._recording().spans
+
+    @property
+    def counters(self):
+        return self._recording().counters
+
+    # Record to ``rec" (a new Recording if None) in this thread until the block exits
+    # Threads started inside the block record elsewhere unless they enter recording(current_recording()) too
+    @contextmanager
+    def recording(self, rec=None):
+        rec = rec if rec is not None else Recording()
+        prev = getattr(self.local, 'recording', None)
+        self.local.recording = rec
+        try:
+            yield rec
+        finally:
+            self.local.recording = prev
+
+    def current_recording(self):
+        return getattr(self.local, 'recording', None)
+
+    def _stack(self):
+        if not hasattr(self.local, 'stack'):
+            self.local.stack = []
+        return self.local.stack
+
+    @contextmanager
+    def span(self, name, cat='alice', **args):
+        sp = self.begin(name, cat, **args)
+        try:
+            yield sp
+        finally:
+            self.end(sp)
+
+    # begin()/end() are for phases that do not fit in a with-block
+    def begin(self, name, cat='alice', **args):
+        if not self.enabled:
+            return None
+        stack = self._stack()
+        sp = Span(name, cat, args, len(stack))
+        stack.append(sp)
+        return sp
+
+    def end(self, sp):
+        if sp is None:
+            return
+        stack = self._stack()
+        if sp in stack:
+            stack.remove(sp)
+        sp.finish()
+        with self.lock:
+            self.spans.append(sp)
+        if Log.isEnabledFor(logging.DEBUG):
+            Log.debug('%s%s: wall %.3fs cpu %.3fs rss %s kB (%s kB since start) process peak rss %d kB', '  '*sp.depth, sp.name,
+                      sp.wall, sp.cpu, sp.rss_kb, sp.rss_growth_kb, sp.process_peak_rss_kb)
+
+    # Decorator version of span()
+    def traced(self, name, cat='alice'):
+        def decorator(fn):
+            @wraps(fn)
+            def wrapper(*args, **kwargs):
+                with self.span(name, cat):
+                    return fn(*args, **kwargs)
+            return wrapper
+        return decorator
+
+    # Clears the recording of the current thread (see recording()), the process-wide one otherwise
+    def reset(self):
+        rec = self._recording()
+        with self.lock:
+            rec.spans = []
+            rec.counters = {}
+
+    # Event counts next to the spans, e.g. candidates tried or emulated instructions
+    def count(self, name, n=1):
+        if not self.enabled:
+            return
+        with self.lock:
+            self.counters[name] = self.counters.get(name, 0) + n
+
+    # Aggregate spans by name: {name: {count, wall, cpu, process_peak_rss_kb}}
+    def summary(self):
+        out = {}
+        for sp in self.spans:
+            s = out.setdefault(sp.name, {'count': 0, 'wall': 0.0, 'cpu': 0.0, 'process_peak_rss_kb': 0, 'depth': sp.depth})
+            s['count'] += 1
+            s['wall'] += sp.wall
+            s['cpu'] += sp.cpu
+            s['process_peak_rss_kb'] = max(s['process_peak_rss_kb'], sp.process_peak_rss_kb)
+            s['depth'] = min(s['depth'], sp.depth)
+        return out
+
+    def log_summary(self, logger=Log):
+        summary = self.summary()
+        for name in sorted(summary.keys(), key=lambda n: (summary[n]['depth'], -summary[n]['wall'])):
+            s = summary[name]
+            logger.warning('%-24s x%-5d wall %9.3fs cpu %9.3fs process peak rss %8d kB', name, s['count'], s['wall'], s['cpu'], s['process_peak_rss_kb'])
+
+    def dump_chrome(self, path):
+        d = os.path.dirname(path)
+        if d and not os.path.exists(d):
+            os.makedirs(d)
+        pid = os.getpid()
+        with open(path, 'w') as f:
+            json.dump({'traceEvents': [sp.to_chrome_event(pid) for sp in self.spans], 'displayTimeUnit': 'ms'}, f)
+
+
+TRACER = Tracer(enabled=os.environ.get('ALICE_TRACE', '1') != '0')
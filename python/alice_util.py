@@ -1,5 +1,13 @@
+import os
+import multiprocessing
 import ahocorasick
 
+# Strings of at least this many bytes are scanned in chunks on several cores (search())
+PARALLEL_SCAN_MIN = 32 << 20
+SCAN_CHUNK = 4 << 20
+# Set ALICE_SCAN_JOBS=1 to always scan in one process
+SCAN_JOBS = int(os.environ.get('ALICE_SCAN_JOBS', multiprocessing.cpu_count()))
+
 def add_element_to_dict(dic, key, val):
     if not key in dic:
         dic[key] = []
@@ -7,7 +15,37 @@ def add_element_to_dict(dic, key, val):
     return dic
 
 
+# Automaton and string of the current chunked scan, inherited by the forked workers (never pickled)
+_scan_auto = None
+_scan_string = None
+
+# [(start_ind, query)] of the matches starting in [start, end); the chunk is read up to end+overlap
+# so that matches crossing its end are found. Each match is reported by the one chunk it starts in
+def _scan_chunk(chunk):
+    start, end, overlap = chunk
+    out = []
+    for end_ind, e in _scan_auto.iter(_scan_string, start, min(end + overlap, len(_scan_string))):
+        start_ind = end_ind - len(e) + 1
+        if start <= start_ind < end:
+            out.append((start_ind, e))
+    return out
+
+def _parallel_scan(auto, search_string, queries):
+    global _scan_auto, _scan_string
+    overlap = max([len(e) for e in queries]) - 1
+    chunks = [(start, min(start + SCAN_CHUNK, len(search_string)), overlap) for start in xrange(0, len(search_string), SCAN_CHUNK)]
+    _scan_auto, _scan_string = auto, search_string
+    pool = multiprocessing.Pool(min(SCAN_JOBS, len(chunks)))
+    try:
+        return [m for matches in pool.map(_scan_chunk, chunks, 1) for m in matches]
+    finally:
+        pool.close()
+        pool.join()
+        _scan_auto, _scan_string = None, None
+
 # Use Aho-Corasick Algorithm (https://en.wikipedia.org/wiki/Aho%E2%80%93Corasick_algorithm)
+# Large strings (PARALLEL_SCAN_MIN) are split into chunks scanned by forked workers; the result is the same
+# (each pattern's indexes in increasing order). Daemonic processes (pool workers) cannot fork and scan in one process
 def search(search_string, queries):
     idxs = {}
 
@@ -20,6 +58,11 @@ def search(search_string, queries):
         auto.add_word(e, e)
     auto.make_automaton()
 
+    if len(search_string) >= PARALLEL_SCAN_MIN and SCAN_JOBS > 1 and not multiprocessing.current_process().daemon:
+        for start_ind, e in _parallel_scan(auto, search_string, queries):
+            idxs = add_element_to_dict(idxs, e, start_ind)
+        return idxs
+
     for end_ind, e in auto.iter(search_string):
         start_ind = end_ind - len(e) + 1
         idxs = add_element_to_dict(idxs, e, start_ind)
@@ -69,6 +112,8 @@ def parse_bytearray(bytearry, format):
     if format == "bytearray":
         return bytearry
     elif format == "hex":
+        if isinstance(bytearry, str):
+            return bytearry.encode("hex")
         return ''.join([x.encode("hex") for x in bytearry])
     else:
         print 'Unsupported Format: ' + format
@@ -1,11 +1,11 @@
 from abstract_caller_analysis import *
 from alice_util import in_range
 from caller_analysis import *
+from memory_budget import BUDGET
 from alice_logger import AliceLog
 import logging
 
 Log = AliceLog['locator']
-Log.setLevel(logging.DEBUG)
 
 
 
@@ -22,39 +22,49 @@ class AngrCallerAnalysis(AbstractCallerAnalysis):
         else:
             self.cfg = binary.angr_proj.analyses.CFGFast(show_progressbar=True, symbols=False)
         self.fn_start_addrs = None
+        self.edge_callers = None
+        self.edge_callees = None
 
     def data_refs(self, start_vaddr, end_vaddr=None):
         return self.simple_ca.data_refs(start_vaddr, end_vaddr)
 
+    # Call graph edges as two arrays sorted by callee (spilled to disk under a memory budget)
+    def get_call_edges(self):
+        if self.edge_callees is None:
+            edges = [(call[0], call[1]) for call, call_type in self.cfg.functions.callgraph.edges.items()]
+            callers = np.array([e[0] for e in edges], dtype=np.int64)
+            callees = np.array([e[1] for e in edges], dtype=np.int64)
+            order = np.argsort(callees, kind='mergesort')
+            self.edge_callers = BUDGET.spill('cfg_edge_callers', callers[order])
+            self.edge_callees = BUDGET.spill('cfg_edge_callees', callees[order])
+        return self.edge_callers, self.edge_callees
+
+    def function_callers(self, fn_start):
+        callers, callees = self.get_call_edges()
+        lo = np.searchsorted(callees, fn_start, side='left')
+        hi = np.searchsorted(callees, fn_start, side='right')
+        return callers[lo:hi].tolist()
+
     def code_refs(self, vaddr):
         # Who is calling ``vaddr"
         out = []
-        for call, call_type in self.cfg.functions.callgraph.edges.items():
-            caller = call[0]
-            callee = call[1]
-            if callee == vaddr:
-                caller_start, caller_end = self.get_func_scope(caller)
-                out += self.get_inst_call_addr(caller_start, caller_end, vaddr)
+        for caller in self.function_callers(vaddr):
+            caller_start, caller_end = self.get_func_scope(caller)
+            out += self.get_inst_call_addr(caller_start, caller_end, vaddr)
 
         return out
         #return [inst.base_vaddr for inst in self.simple_ca.search_insts([CallInst.name()], lambda x: x == vaddr)]
 
-    def function_callers(self, fn_start):
-        out = []
-        for call, call_type in self.cfg.functions.callgraph.edges.items():
-            caller = call[0]
-            callee = call[1]
-            if callee == fn_start:
-                out.append(caller)
-
+    def footprints(self):
+        out = {'cfg edges': [self.edge_callers, self.edge_callees], 'function starts': self.fn_start_addrs}
+        out.update(self.simple_ca.footprints())
         return out
 
     # TODO: use angr's way of doing this (handling indirect_jumps too!)
     # Based on cfg.get_node(caller_start).successors
     def get_inst_call_addr(self, caller_start, caller_end, call_target):
 
-        content = self.binary.angr_proj.loader.memory.read_bytes(caller_start, caller_end-caller_start)
-        insns = self.binary.angr_proj.arch.capstone.disasm(bytearray(content), caller_start)
+        insns = self.binary.disasm(caller_start, caller_end)
         out = []
         for inst in insns:
             i = InstructionFactory.create_instruction(inst)
@@ -69,14 +79,15 @@ class AngrCallerAnalysis(AbstractCallerAnalysis):
             out.add(fn_addr)
         out = list(out)
         out.sort()
-        return out
+        # Under a memory budget, the (possibly memory-mapped) array itself: get_func_scope only bisects it
+        return BUDGET.spill('fn_start_addrs', np.array(out, dtype=np.int64)) if BUDGET.enabled else out
 
     def get_func_scope(self, vaddr):
         if self.fn_start_addrs is None:
             self.fn_start_addrs = self.get_fn_start_addrs()
 
         addr_idx = np.searchsorted(self.fn_start_addrs, vaddr, side='right')
-        entry_addr = self.fn_start_addrs[addr_idx - 1]
+        entry_addr = int(self.fn_start_addrs[addr_idx - 1])
         # exit_addr = self.cfg.functions[entry_addr].size + entry_addr
         exit_addr = entry_addr
 
@@ -85,7 +96,7 @@ class AngrCallerAnalysis(AbstractCallerAnalysis):
         #for ep in self.cfg.functions[entry_addr].endpoints:
         #    if ep is not None and ep.addr+ep.size > exit_addr:
         #        exit_addr = ep.addr+ep.size
-        exit_addr = self.fn_start_addrs[addr_idx]
+        exit_addr = int(self.fn_start_addrs[addr_idx])
 
         #Log.debug('AAAA: entry'+ hex(entry_addr)+' exit: '+ hex(exit_addr)+' ?? '+ hex(self.fn_start_addrs[addr_idx]))
         return entry_addr, exit_addr
@@ -0,0 +1,106 @@
+import os
+import json
+import shutil
+import pickle
+import hashlib
+import tempfile
+from alice_logger import AliceLog
+
+Log = AliceLog['main']
+
+# Bump whenever the output of a phase changes meaning, so stale artifacts are not reused
+ALICE_VERSION = '2'
+
+def file_hash(path):
+    h = hashlib.sha256()
+    with open(path, 'rb') as f:
+        for chunk in iter(lambda: f.read(1 << 20), ''):
+            h.update(chunk)
+    return h.hexdigest()
+
+def obj_hash(obj):
+    return hashlib.sha256(json.dumps(obj, sort_keys=True, default=repr)).hexdigest()
+
+def desc_set_hash(cryptos):
+    return obj_hash([[c.name, c.text_contain, c.text_not_contain, c.rodata_contain, c.rodata_not_contain, c.sample_ios]
+                     for c in sorted(cryptos, key=lambda c: c.name)])
+
+# Write atomically: readers see either the old file or the complete new one, never a partial write
+def atomic_write(path, data):
+    d = os.path.dirname(path)
+    if not os.path.exists(d):
+        try:
+            os.makedirs(d)
+        except OSError:
+            pass
+    fd, tmp = tempfile.mkstemp(dir=d, prefix='.tmp-')
+    with os.fdopen(fd, 'wb') as f:
+        f.write(data)
+    os.rename(tmp, path)
+
+def atomic_copy(src, dst):
+    with open(src, 'rb') as f:
+        atomic_write(dst, f.read())
+    shutil.copymode(src, dst)
+
+
+# Phase outputs (detect/scope/rewrite) keyed by (binary hash, ALICE version, descriptor set, phase config)
+# Layout: <root>/<phase>/<key[:2]>/<key>, plus one scratch directory per run under <root>/runs/
+class ArtifactStore:
+
+    def __init__(self, root, binary_path, cryptos):
+        self.root = root
+        self.binary_hash = file_hash(binary_path)
+        self.desc_hash = desc_set_hash(cryptos)
+        self.run_dir = None
+
+    def key(self, phase, config=None):
+        return obj_hash([self.binary_hash, ALICE_VERSION, self.desc_hash, phase, config])
+
+    def path(self, phase, config=None):
+        key = self.key(phase, config)
+        return os.path.join(self.root, phase, key[:2], key)
+
+    def get(self, phase, config=None):
+        path = self.path(phase, config)
+        if not os.path.exists(path):
+            Log.debug('Artifact miss: %s %s', phase, path)
+            return None
+        Log.info('Artifact hit: ' + phase + ' ' + path)
+        with open(path, 'rb') as f:
+            return pickle.load(f)
+
+    def put(self, phase, obj, config=None):
+        atomic_write(self.path(phase, config), pickle.dumps(obj))
+
+    # Whole files, e.g. the patched binary
+    def get_file(self, phase, dst, config=None):
+        path = self.path(phase, config)
+        if not os.path.exists(path):
+            Log.debug('Artifact miss: %s %s', phase, path)
+            return False
+        Log.info('Artifact hit: ' + phase + ' ' + path)
+        atomic_copy(path, dst)
+        return True
+
+    def put_file(self, phase, src, config=None):
+        atomic_copy(src, self.path(phase, config))
+
+    # Scratch directory private to this run, so concurrent runs never share intermediate files
+    def get_run_dir(self):
+        if self.run_dir is None:
+            runs = os.path.join(self.root, 'runs')
+            if not os.path.exists(runs):
+                try:
+                    os.makedirs(runs)
+                except OSError:
+                    pass
+            self.run_dir = tempfile.mkdtemp(dir=runs, prefix=self.binary_hash[:12] + '-')
+        return self.run_dir
+
+    # Remove the scratch directory once the phase outputs made from it are stored
+    # Not called when a phase fails, so its intermediate files are left for inspection
+    def release_run_dir(self):
+        if self.run_dir is not None:
+            shutil.rmtree(self.run_dir, ignore_errors=True)
+            self.run_dir = None
@@ -1,13 +1,12 @@
 import angr
-import signal
 from func_args import *
 from capstone.x86 import *
+from execution_budget import *
+from alice_trace import TRACER
+from alice_logger import AliceLog
 
-class TimeoutError(Exception):
-    pass
+Log = AliceLog['main']
 
-def _handle_timeout(signum, frame):
-    raise TimeoutError('timeout')
 
 def print_mem(mem, start, size):
     for i in xrange(0, size):
@@ -27,13 +26,15 @@ def read_byte_mem(mem, start, bytesize):
 
 
 class CryptoAsserter:
+    BACKEND = 'emulated'
     IN_ADDR = 0x2000
     OUT_ADDR = 0x3000
     IN_LEN = 9
     TEST_STRING = "oakoakoak"+'\0'
 
-    def __init__(self, angr_proj):
+    def __init__(self, angr_proj, budget=DEFAULT_BUDGET):
         self.p = angr_proj
+        self.budget = budget
 
     def __mem_set(self, mem, start_idx, size, val):
          for i in xrange(0, size):
@@ -52,10 +53,10 @@ class CryptoAsserter:
         return True
 
     def execute_fn(self, fn_addr, out_bytelen, argv):
-        fn = self._execute_fn(fn_addr, argv)
+        state = self._execute_fn(fn_addr, argv, out_bytelen)
         for arg in argv:
             if arg.expected_output is not None:
-                arg.output = read_byte_mem(fn.result_state.mem, arg.val, out_bytelen)
+                arg.output = read_byte_mem(state.mem, arg.val, out_bytelen)
         return argv
 
     def get_output_reg(self, fn_addr, argv, out_idx=None):
@@ -80,14 +81,79 @@ class CryptoAsserter:
         else:
             return None
 
-    def _execute_fn(self, fn_addr, argv):
+    # Return the state at the return of fn_addr
+    def _execute_fn(self, fn_addr, argv, out_bytelen=64):
         init_state = self.p.factory.blank_state()
         for arg in argv:
             self.fill_state(init_state, arg)
-        fn = self.p.factory.callable(fn_addr, base_state=init_state, concrete_only=True)
-        fn.perform_call(*[x.val for x in argv])
-        #self.perform_call(fn, *[x.val for x in argv])
-        return fn
+        state = self.p.factory.call_state(fn_addr, *[x.val for x in argv], base_state=init_state)
+        buffers = [(x.val, max(len(x.ref_val), out_bytelen)) for x in argv if x.type == AliceArg.TYPE_BYTE_POINTER]
+        return self.run_bounded(state, buffers)
+
+    # Step ``state" until it returns, within self.budget. Only the stack, the heap and ``buffers"
+    # ([(addr, size)], i.e. the pointer arguments) may be written. Raise ExecutionAborted otherwise
+    def run_bounded(self, state, buffers):
+        budget = self.budget
+        sp = state.solver.eval(state.regs.rsp)
+        writable = [(sp - budget.stack_size, sp + 0x100)] + [(addr, addr + size) for addr, size in buffers]
+        heap = state.heap
+        if hasattr(heap, 'heap_base') and hasattr(heap, 'heap_size'):
+            writable.append((heap.heap_base, heap.heap_base + heap.heap_size))
+
+        def on_write(st):
+            if 'abort' in st.globals:
+                return
+            addr = st.inspect.mem_write_address
+            if st.solver.symbolic(addr):
+                st.globals['abort'] = 'symbolic write address'
+                return
+            addr = st.solver.eval(addr)
+            if not any([lo <= addr < hi for lo, hi in writable]):
+                st.globals['abort'] = 'write outside stack/output at %#x' % addr
+        state.inspect.b('mem_write', when=angr.BP_BEFORE, action=on_write)
+
+        simgr = self.p.factory.simulation_manager(state)
+        num_insts = [0]
+        try:
+            return self._step_bounded(simgr, num_insts)
+        finally:
+            TRACER.count('emulated_insts', num_insts[0])
+
+    def _step_bounded(self, simgr, num_insts):
+        budget = self.budget
+        blocks = set()
+        while simgr.active:
+            # Same rule as Callable(concrete_only=True): a single path
+            if len(simgr.active) != 1:
+                raise ExecutionAborted('%d paths' % len(simgr.active))
+            st = simgr.active[0]
+            if 'abort' in st.globals:
+                raise ExecutionAborted(st.globals['abort'])
+
+            addr = st.addr
+            if self.p.is_hooked(addr):
+                proc = self.p.hooked_by(addr)
+                if budget.abort_on_stub and getattr(proc, 'is_stub', False):
+                    raise ExecutionAborted('call to unresolved %s at %#x' % (proc.display_name, addr))
+            else:
+                blocks.add(addr)
+                if len(blocks) > budget.max_blocks:
+                    raise ExecutionAborted('more than %d basic blocks' % budget.max_blocks)
+
+            simgr.step()
+            if simgr.active:
+                num_insts[0] += max(simgr.active[0].history.recent_instruction_count, 0)
+                if num_insts[0] > budget.max_insts:
+                    raise ExecutionAborted('more than %d instructions' % budget.max_insts)
+
+        if simgr.errored:
+            raise ExecutionAborted(str(simgr.errored[0].error))
+        if len(simgr.deadended) != 1:
+            raise ExecutionAborted('%d returning paths' % len(simgr.deadended))
+        final = simgr.deadended[0]
+        if 'abort' in final.globals:
+            raise ExecutionAborted(final.globals['abort'])
+        return final
 
     def perform_call(self, fn, *args):
         state = fn._project.factory.call_state(fn._addr, *args, cc=fn._cc, base_state = fn._base_state, ret_addr = fn._deadend_addr, toc = fn._toc)
@@ -117,6 +183,57 @@ class CryptoAsserter:
         exit(1)
         return fn
 
+    # Execute fn_addr once and infer which layout of generate_all_possible_args it uses.
+    # rdi points to a buffer holding the input, rsi = rdx = in_len, and the input is also stored at address in_len,
+    # so each register is valid in every role it can have:
+    #   in_inlen_out: reads rdi[:in_len], writes the digest at rdx
+    #   out_in, out_in_inlen: reads the input at rsi, writes the digest at rdi
+    # out_in_inlen is told apart from out_in by rdx (the length) being read before it is written.
+    # Return the signature name, False if no digest was produced, or None if the layout cannot be probed
+    def probe_signature(self, fn_addr, out_bytelen, in_bytes, in_len, expected_output, buf_addr=0x200):
+        result = self.probe_outputs(fn_addr, out_bytelen, in_bytes, in_len, buf_addr)
+        if not result:
+            return result
+        return probe_match(result, expected_output[:out_bytelen])
+
+    # The execution of probe_signature: return (out_bytelen bytes at buf_addr, at in_len, whether rdx was read first),
+    # False if the execution was aborted, or None if the layout cannot be probed
+    def probe_outputs(self, fn_addr, out_bytelen, in_bytes, in_len, buf_addr=0x200):
+        # The input/output at address in_len must not overlap the buffer at buf_addr
+        if in_len <= 0 or in_len + max(len(in_bytes), out_bytelen) >= buf_addr:
+            return None
+
+        init_state = self.p.factory.blank_state()
+        self.__mem_cpy(init_state.mem, buf_addr, len(in_bytes), in_bytes)
+        self.__mem_cpy(init_state.mem, in_len, len(in_bytes), in_bytes)
+        state = self.p.factory.call_state(fn_addr, buf_addr, in_len, in_len, base_state=init_state)
+
+        # Only set after call_state, which writes the arguments
+        rdx_offset = self.p.arch.registers['rdx'][0]
+        def on_reg(st, access):
+            if 'rdx_access' in st.globals:
+                return
+            offset = st.inspect.reg_read_offset if access == 'r' else st.inspect.reg_write_offset
+            if not isinstance(offset, (int, long)):
+                offset = st.solver.eval(offset)
+            if offset == rdx_offset:
+                st.globals['rdx_access'] = access
+        state.inspect.b('reg_read', when=angr.BP_BEFORE, action=lambda st: on_reg(st, 'r'))
+        state.inspect.b('reg_write', when=angr.BP_BEFORE, action=lambda st: on_reg(st, 'w'))
+
+        try:
+            final = self.run_bounded(state, [(buf_addr, max(len(in_bytes), out_bytelen)), (in_len, max(len(in_bytes), out_bytelen))])
+        except ExecutionAborted as e:
+            Log.debug('Fn addr: %#x Aborted: %s', fn_addr, e)
+            return False
+
+        return (read_byte_mem(final.mem, buf_addr, out_bytelen), read_byte_mem(final.mem, in_len, out_bytelen),
+                final.globals.get('rdx_access') == 'r')
+
+    # Nothing to release, see NativeAsserter.close
+    def close(self):
+        pass
+
     def fill_state(self, state, arg):
         if arg.type == AliceArg.TYPE_BYTE_POINTER:
             self.__mem_cpy(state.mem, arg.val, len(arg.ref_val), arg.ref_val)
@@ -127,29 +244,24 @@ class CryptoAsserter:
             return False
         return output.upper() == out_hexstr.upper()
 
-    def get_fn_output(self, fn_addr, in_str=None, in_len=None, out_len=None, timeout_seconds=60):
+    def get_fn_output(self, fn_addr, in_str=None, in_len=None, out_len=None):
         if in_str is None:
             in_str = self.TEST_STRING
         if in_len is None:
             in_len = self.IN_LEN
         if out_len is None:
             out_len = 64
-        h = self.generate_callable(fn_addr, in_str, in_len, out_len)
-        
-        signal.signal(signal.SIGALRM, _handle_timeout)
-        signal.alarm(timeout_seconds)
+        s = self.generate_base_state(in_str, in_len, out_len)
 
         print 'Call with params: ', self.IN_ADDR, in_len, self.OUT_ADDR
     
         try:
-            h.perform_call(self.IN_ADDR, in_len, self.OUT_ADDR)
-            #h.perform_call(self.OUT_ADDR, self.IN_ADDR)
-            output = read_mem(h.result_state.mem, self.OUT_ADDR, out_len)
+            state = self.p.factory.call_state(fn_addr, self.IN_ADDR, in_len, self.OUT_ADDR, base_state=s)
+            state = self.run_bounded(state, [(self.IN_ADDR, max(in_len, out_len)), (self.OUT_ADDR, out_len)])
+            output = read_mem(state.mem, self.OUT_ADDR, out_len)
         except Exception as e:
             output = None
             print 'Fn addr: ' + hex(fn_addr) + ' Asserter Exception: ' + str(e)
-        finally:
-            signal.alarm(0)
 
         print output
         return output
@@ -0,0 +1,236 @@
+#!/usr/bin/env python2
+# Speed of ALICE itself: run the phases (locator, scoper, asserter, taint scoping when the taint tool is
+# installed, rewriter) over a fixed corpus and compare with a stored baseline.
+# Each binary runs in a fresh process with an empty output directory, so nothing comes from the artifact store.
+#
+# Usage: python bench_pipeline.py [--only coreutils|curl|lighttpd|ldap] [--cfg region|full] [--reps N]
+#                                 [--results bench_pipeline.json] [--baseline bench_pipeline_baseline.json]
+#                                 [--save-baseline] [--tolerance 0.10]
+import os
+import sys
+import glob
+import json
+import time
+import shutil
+import argparse
+import resource
+import tempfile
+import traceback
+import multiprocessing
+from alice import AliceJob, load_binary, detect_stage, scope_stage, rewrite_stage
+from alice_trace import TRACER
+from desc import MD5Desc, SHA1Desc
+
+TESTCASES = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'testcases')
+CONFIG_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'configs')
+
+# (suite, binaries, cryptos for binaries without a config)
+CORPUS = [('coreutils', os.path.join(TESTCASES, 'coreutils-5.2.1/bin/*'), None),
+          ('curl', os.path.join(TESTCASES, 'curl-7.56.0/bin/*'), [MD5Desc]),
+          ('lighttpd', os.path.join(TESTCASES, 'lighttpd-1.4.49/oak/lighttpd-*'), [SHA1Desc]),
+          ('ldap', os.path.join(TESTCASES, 'ldap-passwords/bin/*'), None)]
+
+# Spans of alice_trace reported per binary
+PHASES = ['load', 'cfg', 'locator', 'scoper', 'ranker', 'asserter', 'detect', 'taint', 'rewrite']
+# Counters of alice_trace reported per binary
+COUNTERS = ['candidates', 'candidate_executions', 'emulated_insts', 'native_calls', 'patches']
+
+# A binary regresses if one of these grows by more than the tolerance
+COST_KEYS = ['wall', 'cpu', 'peak_rss_kb']
+
+
+# {binary basename: config module name}, from exec_path of every config
+def load_configs():
+    configs = {}
+    for path in glob.glob(os.path.join(CONFIG_DIR, '*.py')):
+        name = os.path.splitext(os.path.basename(path))[0]
+        try:
+            job = AliceJob.from_config(name, CONFIG_DIR)
+        except Exception as e:
+            print 'Skipping config ' + name + ': ' + str(e)
+            continue
+        configs[os.path.basename(job.exec_path)] = name
+    return configs
+
+def default_cryptos(name):
+    if 'sha1' in name or 'ssha' in name:
+        return [SHA1Desc]
+    return [MD5Desc]
+
+def build_corpus(only=None):
+    configs = load_configs()
+    corpus = []
+    for suite, pattern, cryptos in CORPUS:
+        if only and suite != only:
+            continue
+        for path in sorted(glob.glob(pattern)):
+            if not os.path.isfile(path) or open(path, 'rb').read(4) != '\x7fELF':
+                continue
+            name = os.path.basename(path)
+            corpus.append((suite, name, path, configs.get(name), cryptos or default_cryptos(name)))
+    return corpus
+
+# The taint tool is only run where it is installed (first word of the command line, after sudo)
+def taint_tool_available(scope_input):
+    cmdline = scope_input.get('cmdline') if isinstance(scope_input, dict) else scope_input
+    if not isinstance(cmdline, basestring):
+        return False
+    words = [w for w in cmdline.split() if w != 'sudo']
+    return bool(words) and os.path.exists(words[0])
+
+
+# Runs in a fresh pool process: one pass of all phases over one binary
+def bench_one(path, config, cryptos, cfg_mode):
+    TRACER.reset()
+    out_dir = tempfile.mkdtemp(prefix='alice-bench-pipeline-')
+    result = {'errors': {}}
+    start_wall = time.time()
+    start = resource.getrusage(resource.RUSAGE_SELF)
+    try:
+        if config is not None:
+            cfg_job = AliceJob.from_config(config, CONFIG_DIR)
+            job = AliceJob(path, cfg_job.cryptos, cfg_job.scope_inputs, cfg_job.force_insts, cfg_job.fns)
+        else:
+            job = AliceJob(path, cryptos, None)
+
+        binary = load_binary(path, cfg_mode)
+        patched_entries = detect_stage(job, out_dir, cfg_mode, binary)
+        taint_stack_mems = set()
+        if patched_entries and all([taint_tool_available(x) for x in job.scope_inputs]):
+            try:
+                taint_stack_mems = scope_stage(job, out_dir, patched_entries) or set()
+            except Exception:
+                result['errors']['scope'] = traceback.format_exc().splitlines()[-1]
+        if patched_entries:
+            # Without scoping output, only the entry patches are emitted
+            try:
+                rewrite_stage(job, out_dir, patched_entries, taint_stack_mems, cfg_mode, binary)
+            except Exception:
+                result['errors']['rewrite'] = traceback.format_exc().splitlines()[-1]
+        result['entries'] = sum([len(v) for v in patched_entries.values()])
+    except Exception:
+        result['errors']['detect'] = traceback.format_exc().splitlines()[-1]
+    finally:
+        shutil.rmtree(out_dir, ignore_errors=True)
+
+    end = resource.getrusage(resource.RUSAGE_SELF)
+    result['wall'] = time.time() - start_wall
+    result['cpu'] = (end.ru_utime + end.ru_stime) - (start.ru_utime + start.ru_stime)
+    result['peak_rss_kb'] = end.ru_maxrss
+    summary = TRACER.summary()
+    # Per phase, peak RSS of this (fresh) process at the end of the phase
+    result['phases'] = dict([(p, {'wall': summary[p]['wall'], 'cpu': summary[p]['cpu'], 'peak_rss_kb': summary[p]['process_peak_rss_kb']})
+                             for p in PHASES if p in summary])
+    result['counts'] = dict([(c, TRACER.counters.get(c, 0)) for c in COUNTERS])
+    return result
+
+def run_isolated(path, config, cryptos, cfg_mode):
+    pool = multiprocessing.Pool(1)
+    try:
+        return pool.apply(bench_one, (path, config, cryptos, cfg_mode))
+    finally:
+        pool.close()
+        pool.join()
+
+# Fastest of the repetitions for every time/RSS figure, counts from the first one
+def best_of(runs):
+    best = dict(runs[0])
+    for key in COST_KEYS:
+        best[key] = min([r[key] for r in runs])
+    phases = {}
+    for r in runs:
+        for p, m in r['phases'].items():
+            cur = phases.setdefault(p, dict(m))
+            for key in COST_KEYS:
+                cur[key] = min(cur[key], m[key])
+    best['phases'] = phases
+    return best
+
+
+# [(binary, metric, baseline, current, ratio)] over the totals and the phases
+def compare(baseline, results, tolerance):
+    regressions = []
+    for name, res in sorted(results.items()):
+        base = baseline.get(name)
+        if base is None:
+            continue
+        pairs = [('', base, res)] + [(p + '.', base['phases'][p], res['phases'].get(p, {})) for p in sorted(base.get('phases', {}).keys())]
+        for prefix, b, r in pairs:
+            for key in COST_KEYS:
+                if not b.get(key) or r.get(key) is None:
+                    continue
+                ratio = float(r[key])/b[key]
+                if ratio > 1+tolerance:
+                    regressions.append((name, prefix+key, b[key], r[key], ratio))
+        # More work for the same binary is a regression too (patches is an output, not work)
+        for key, b in base.get('counts', {}).items():
+            r = res['counts'].get(key)
+            if key != 'patches' and r is not None and b and r > b:
+                regressions.append((name, 'count.'+key, b, r, float(r)/b))
+    return regressions
+
+def print_result(name, res):
+    counts = ' '.join(['%s=%d' % (c, res['counts'][c]) for c in COUNTERS if res['counts'].get(c)])
+    print '%-28s wall %8.2fs cpu %8.2fs rss %8d kB  %s' % (name, res['wall'], res['cpu'], res['peak_rss_kb'], counts)
+    for p in PHASES:
+        if p in res['phases']:
+            m = res['phases'][p]
+            print '    %-10s wall %8.2fs cpu %8.2fs rss %8d kB' % (p, m['wall'], m['cpu'], m['peak_rss_kb'])
+    for phase, err in sorted(res['errors'].items()):
+        print '    %-10s error: %s' % (phase, err)
+
+def main():
+    parser = argparse.ArgumentParser(description='Per-phase benchmark of the ALICE pipeline')
+    parser.add_argument('--only', choices=[c[0] for c in CORPUS])
+    parser.add_argument('--cfg', default='region', choices=['region', 'full'])
+    parser.add_argument('--reps', type=int, default=1)
+    parser.add_argument('--results', default='bench_pipeline.json')
+    parser.add_argument('--baseline', default='bench_pipeline_baseline.json')
+    parser.add_argument('--save-baseline', action='store_true', help='store these results as the new baseline')
+    parser.add_argument('--tolerance', type=float, default=0.10)
+    args = parser.parse_args()
+
+    corpus = build_corpus(args.only)
+    if not corpus:
+        print 'No binary found under ' + TESTCASES
+        return 1
+
+    results = {}
+    for suite, name, path, config, cryptos in corpus:
+        res = best_of([run_isolated(path, config, cryptos, args.cfg) for _ in xrange(args.reps)])
+        res['suite'] = suite
+        res['config'] = config
+        results[name] = res
+        print_result(name, res)
+
+    with open(args.results, 'w') as f:
+        json.dump({'cfg': args.cfg, 'results': results}, f, indent=2, sort_keys=True)
+    print 'Results written to ' + args.results
+
+    if args.save_baseline:
+        shutil.copyfile(args.results, args.baseline)
+        print 'Baseline saved to ' + args.baseline
+        return 0
+    if not os.path.exists(args.baseline):
+        print 'No baseline (' + args.baseline + '), run with --save-baseline to create one'
+        return 0
+
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+    if baseline.get('cfg') != args.cfg:
+        print 'Baseline was recorded with --cfg ' + str(baseline.get('cfg'))
+    regressions = compare(baseline['results'], results, args.tolerance)
+    for name, key, b, r, ratio in regressions:
+        print 'REGRESSION %-28s %-24s %12.2f -> %12.2f (x%.2f)' % (name, key, b, r, ratio)
+    for name in sorted(results.keys()):
+        b = baseline['results'].get(name, {}).get('counts', {}).get('patches')
+        if b is not None and b != results[name]['counts'].get('patches'):
+            print 'CHANGED    %-28s patches %d -> %d' % (name, b, results[name]['counts'].get('patches'))
+    missing = sorted(set(baseline['results'].keys()) - set(results.keys()))
+    if missing:
+        print 'Not run (in baseline): ' + ', '.join(missing)
+    return 1 if regressions else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,341 @@
+#!/usr/bin/env python2
+# Runtime cost of a rewrite: run baseline/patched pairs of the testcase binaries
+# (plus freshly ALICE-patched outputs from out/) on local workloads and compare them.
+#
+# Usage: python bench_runtime.py [--only md5sum|lighttpd|curl] [--max-size BYTES] [--reps N]
+#                                [--out-dir ./out] [--results bench_runtime.json] [--tolerance 0.05]
+import os
+import sys
+import time
+import json
+import socket
+import hashlib
+import tempfile
+import threading
+import subprocess
+import httplib
+import argparse
+import BaseHTTPServer
+
+TESTCASES = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'testcases')
+COREUTILS_BIN = os.path.join(TESTCASES, 'coreutils-5.2.1/bin')
+CURL_BIN = os.path.join(TESTCASES, 'curl-7.56.0/bin')
+LIGHTTPD_OAK = os.path.join(TESTCASES, 'lighttpd-1.4.49/oak')
+
+OPT_LEVELS = ['O0', 'O1', 'O2', 'O3', 'Os']
+
+# (workload, baseline binary, compared binary)
+BENCH_PAIRS = \
+    [('md5sum', os.path.join(COREUTILS_BIN, 'md5sum_'+o), os.path.join(COREUTILS_BIN, 'md5sum_'+o+'_sha256')) for o in OPT_LEVELS] + \
+    [('lighttpd', os.path.join(LIGHTTPD_OAK, 'lighttpd-baseline-'+o), os.path.join(LIGHTTPD_OAK, 'lighttpd-'+o)) for o in OPT_LEVELS] + \
+    [('curl', os.path.join(CURL_BIN, 'curl-baseline-'+o), os.path.join(CURL_BIN, 'curl-'+o)) for o in ['O0', 'O1', 'O2', 'Os']]
+
+MD5SUM_SIZES = [1 << 20, 16 << 20, 256 << 20, 1 << 30, 4 << 30]
+LIGHTTPD_PATHS = ['/index.html', '/test/']
+LIGHTTPD_USER = ('oak', 'oak')
+CURL_USER = ('susan', 'bye2')
+
+# A compared binary regresses if its throughput drops, or its RSS/page faults grow, by more than the tolerance
+THROUGHPUT_KEYS = ['throughput']
+COST_KEYS = ['p50', 'p99', 'max_rss_kb', 'minflt', 'majflt']
+
+
+def percentile(vals, pct):
+    if not vals:
+        return None
+    vals = sorted(vals)
+    idx = int(round(pct/100.0*(len(vals)-1)))
+    return vals[idx]
+
+def summarize(latencies, work, max_rss_kb, minflt, majflt):
+    total = sum(latencies)
+    return {'throughput': work/total if total > 0 else None,
+            'p50': percentile(latencies, 50),
+            'p90': percentile(latencies, 90),
+            'p99': percentile(latencies, 99),
+            'max_rss_kb': max_rss_kb,
+            'minflt': minflt,
+            'majflt': majflt}
+
+# Output of the benchmarked binaries, opened once in main()
+DEVNULL = None
+
+class BenchFailure(Exception):
+    pass
+
+# Run cmd to completion, return (wall time, rusage of the child)
+# A run that does not exit with status 0 raises BenchFailure rather than being timed
+def run_measured(cmd, stdin=None, stdout=None):
+    start = time.time()
+    proc = subprocess.Popen(cmd, stdin=stdin, stdout=stdout or DEVNULL, stderr=subprocess.STDOUT)
+    _, status, rusage = os.wait4(proc.pid, 0)
+    elapsed = time.time() - start
+    if os.WIFSIGNALED(status):
+        proc.returncode = -os.WTERMSIG(status)
+        raise BenchFailure(' '.join(cmd) + ' killed by signal ' + str(os.WTERMSIG(status)))
+    proc.returncode = os.WEXITSTATUS(status)
+    if proc.returncode != 0:
+        raise BenchFailure(' '.join(cmd) + ' exited with status ' + str(proc.returncode))
+    return elapsed, rusage
+
+def proc_stats(pid):
+    max_rss_kb = None
+    with open('/proc/%d/status' % pid) as f:
+        for line in f:
+            if line.startswith('VmHWM:'):
+                max_rss_kb = int(line.split()[1])
+    with open('/proc/%d/stat' % pid) as f:
+        fields = f.read().rsplit(')', 1)[1].split()
+    # minflt and majflt are fields 10 and 12 of /proc/<pid>/stat, counted from 1
+    return max_rss_kb, int(fields[7]), int(fields[9])
+
+def wait_for_port(port, timeout=10):
+    end = time.time() + timeout
+    while time.time() < end:
+        try:
+            socket.create_connection(('127.0.0.1', port), 0.2).close()
+            return True
+        except socket.error:
+            time.sleep(0.05)
+    return False
+
+def free_port():
+    s = socket.socket()
+    s.bind(('127.0.0.1', 0))
+    port = s.getsockname()[1]
+    s.close()
+    return port
+
+
+############################ md5sum ##################################
+
+def generate_file(path, size):
+    if os.path.exists(path) and os.path.getsize(path) == size:
+        return
+    block = os.urandom(1 << 20)
+    with open(path, 'wb') as f:
+        for i in xrange(0, size, len(block)):
+            f.write(block[:min(len(block), size-i)])
+
+def bench_md5sum(binary, args):
+    out = {}
+    for size in [s for s in MD5SUM_SIZES if s <= args.max_size]:
+        path = os.path.join(args.work_dir, 'md5sum_input_' + str(size))
+        generate_file(path, size)
+        latencies = []
+        max_rss_kb = minflt = majflt = 0
+        for _ in range(args.reps):
+            t, ru = run_measured([binary, path])
+            latencies.append(t)
+            max_rss_kb = max(max_rss_kb, ru.ru_maxrss)
+            minflt = max(minflt, ru.ru_minflt)
+            majflt = max(majflt, ru.ru_majflt)
+        # Throughput in MB/s
+        out[str(size)] = summarize(latencies, float(size*len(latencies))/(1 << 20), max_rss_kb, minflt, majflt)
+    return out
+
+
+############################ lighttpd ################################
+
+LIGHTTPD_CONF = '''
+server.port = %(port)d
+server.bind = "127.0.0.1"
+server.document-root = "%(www)s"
+server.errorlog = "%(work)s/lighttpd_error.log"
+server.modules = ( "mod_auth", "mod_authn_file" )
+auth.backend = "htpasswd"
+auth.backend.htpasswd.userfile = "%(htpasswd)s"
+auth.require = ( "/test" => ( "method" => "basic", "realm" => "Enter password", "require" => "valid-user" ) )
+mimetype.assign = ( ".html" => "text/html" )
+index-file.names = ( "index.html" )
+'''
+
+# Load generator: ``clients" keep-alive connections, each sending ``requests" requests
+def http_load(port, paths, auth, clients, requests):
+    latencies = []
+    lock = threading.Lock()
+    headers = {'Authorization': 'Basic ' + (auth[0] + ':' + auth[1]).encode('base64').strip()}
+
+    def client():
+        local = []
+        conn = httplib.HTTPConnection('127.0.0.1', port)
+        for i in range(requests):
+            start = time.time()
+            conn.request('GET', paths[i % len(paths)], headers=headers)
+            conn.getresponse().read()
+            local.append(time.time() - start)
+        conn.close()
+        with lock:
+            latencies.extend(local)
+
+    threads = [threading.Thread(target=client) for _ in range(clients)]
+    start = time.time()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    return latencies, time.time() - start
+
+def bench_lighttpd(binary, args):
+    port = free_port()
+    conf = os.path.join(args.work_dir, 'lighttpd-bench.conf')
+    with open(conf, 'w') as f:
+        f.write(LIGHTTPD_CONF % {'port': port, 'www': os.path.join(LIGHTTPD_OAK, 'www'), 'work': args.work_dir,
+                                 'htpasswd': os.path.join(LIGHTTPD_OAK, 'htpasswd')})
+
+    proc = subprocess.Popen([binary, '-f', conf, '-D'], stdout=DEVNULL, stderr=subprocess.STDOUT)
+    try:
+        if not wait_for_port(port):
+            raise RuntimeError('lighttpd did not start: ' + binary)
+        latencies, wall = http_load(port, LIGHTTPD_PATHS, LIGHTTPD_USER, args.clients, args.requests)
+        max_rss_kb, minflt, majflt = proc_stats(proc.pid)
+    finally:
+        proc.terminate()
+        proc.wait()
+
+    # Throughput in requests/s over the whole run, not the sum of latencies
+    out = summarize(latencies, 0, max_rss_kb, minflt, majflt)
+    out['throughput'] = len(latencies)/wall
+    return {'requests': out}
+
+
+############################ curl ####################################
+
+# Stand-in for the digest-protected server used by configs/curl_O2.py
+class DigestHandler(BaseHTTPServer.BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def do_GET(self):
+        if 'Digest ' not in self.headers.get('Authorization', ''):
+            nonce = hashlib.md5(str(time.time())).hexdigest()
+            self.send_response(401)
+            self.send_header('WWW-Authenticate', 'Digest realm="alice", qop="auth", nonce="' + nonce + '", algorithm=MD5')
+            self.send_header('Content-Length', '0')
+            self.end_headers()
+            return
+        body = 'ok\n'
+        self.send_response(200)
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, *args):
+        pass
+
+def bench_curl(binary, args):
+    server = BaseHTTPServer.HTTPServer(('127.0.0.1', 0), DigestHandler)
+    thread = threading.Thread(target=server.serve_forever)
+    thread.daemon = True
+    thread.start()
+    url = 'http://127.0.0.1:%d/' % server.server_address[1]
+
+    latencies = []
+    max_rss_kb = minflt = majflt = 0
+    try:
+        for _ in range(args.requests):
+            t, ru = run_measured([binary, '-s', '-o', os.devnull, '--digest', '--user', CURL_USER[0]+':'+CURL_USER[1], url])
+            latencies.append(t)
+            max_rss_kb = max(max_rss_kb, ru.ru_maxrss)
+            minflt = max(minflt, ru.ru_minflt)
+            majflt = max(majflt, ru.ru_majflt)
+    finally:
+        server.shutdown()
+
+    # Throughput in runs/s
+    return {'digest': summarize(latencies, len(latencies), max_rss_kb, minflt, majflt)}
+
+
+######################################################################
+
+WORKLOADS = {'md5sum': bench_md5sum, 'lighttpd': bench_lighttpd, 'curl': bench_curl}
+
+# out/<name>-patched.o is what alice.py produces for the baseline binary <name>
+def alice_patched(baseline, out_dir):
+    name, _ = os.path.splitext(os.path.basename(baseline))
+    path = os.path.join(out_dir, name + '-patched.o')
+    return path if os.path.exists(path) else None
+
+def compare(base, other, tolerance):
+    regressions = []
+    for workload, metrics in base.items():
+        for key in THROUGHPUT_KEYS + COST_KEYS:
+            b = metrics.get(key)
+            o = other.get(workload, {}).get(key)
+            if not b or o is None:
+                continue
+            ratio = float(o)/b
+            if (key in THROUGHPUT_KEYS and ratio < 1-tolerance) or (key in COST_KEYS and ratio > 1+tolerance):
+                regressions.append((workload, key, b, o, ratio))
+    return regressions
+
+def print_table(name, results):
+    print name
+    print '  %-12s %12s %10s %10s %10s %10s %8s %8s' % ('workload', 'throughput', 'p50', 'p90', 'p99', 'rss(kB)', 'minflt', 'majflt')
+    for workload in sorted(results.keys()):
+        r = results[workload]
+        print '  %-12s %12.2f %10.5f %10.5f %10.5f %10d %8d %8d' % (workload, r['throughput'] or 0, r['p50'], r['p90'], r['p99'], r['max_rss_kb'] or 0, r['minflt'], r['majflt'])
+
+# Results of one binary, None (and the reason printed) if it failed
+def run_workload(workload, binary, args):
+    try:
+        return WORKLOADS[workload](binary, args)
+    except (BenchFailure, RuntimeError) as e:
+        print 'FAILED %s: %s' % (os.path.basename(binary), e)
+        return None
+
+def main():
+    global DEVNULL
+    parser = argparse.ArgumentParser(description='Runtime benchmark of patched vs. baseline binaries')
+    parser.add_argument('--only', choices=sorted(WORKLOADS.keys()))
+    parser.add_argument('--max-size', type=int, default=256 << 20, help='largest md5sum input in bytes (up to 4 GB)')
+    parser.add_argument('--reps', type=int, default=5)
+    parser.add_argument('--clients', type=int, default=4)
+    parser.add_argument('--requests', type=int, default=200)
+    parser.add_argument('--out-dir', default='./out', help='where alice.py writes *-patched.o')
+    parser.add_argument('--work-dir', default=None)
+    parser.add_argument('--results', default='bench_runtime.json')
+    parser.add_argument('--tolerance', type=float, default=0.05)
+    args = parser.parse_args()
+    if args.work_dir is None:
+        args.work_dir = tempfile.mkdtemp(prefix='alice-bench-')
+
+    all_results = {}
+    failed = False
+    DEVNULL = open(os.devnull, 'w')
+    try:
+        for workload, baseline, other in BENCH_PAIRS:
+            if args.only and workload != args.only:
+                continue
+            if not os.path.exists(baseline):
+                print 'Skipping missing baseline: ', baseline
+                continue
+
+            candidates = [other, alice_patched(baseline, args.out_dir)]
+            base_res = run_workload(workload, baseline, args)
+            if base_res is None:
+                failed = True
+                continue
+            all_results[baseline] = base_res
+            print_table(os.path.basename(baseline), base_res)
+
+            for cand in candidates:
+                if cand is None or not os.path.exists(cand):
+                    continue
+                res = run_workload(workload, cand, args)
+                if res is None:
+                    failed = True
+                    continue
+                all_results[cand] = res
+                print_table(os.path.basename(cand), res)
+                for w, key, b, o, ratio in compare(base_res, res, args.tolerance):
+                    failed = True
+                    print '  REGRESSION %s %s: %s -> %s (x%.3f)' % (w, key, b, o, ratio)
+    finally:
+        DEVNULL.close()
+
+    with open(args.results, 'w') as f:
+        json.dump(all_results, f, indent=4, sort_keys=True)
+    sys.exit(1 if failed else 0)
+
+if __name__ == '__main__':
+    main()
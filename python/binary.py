@@ -1,5 +1,9 @@
-import angr
 import copy
+from bisect import bisect_left, bisect_right
+from capstone import Cs, CS_ARCH_X86, CS_MODE_64, CS_OPT_SYNTAX_ATT
+from capstone.x86 import X86_GRP_JUMP, X86_GRP_CALL, X86_GRP_RET, X86_OP_IMM
+from elf_loader import ElfFile
+from memory_budget import BUDGET
 from alice_util import *
 
 # Very X86-ELF specific
@@ -13,6 +17,8 @@ class BinaryObject:
         return parse_bytearray(self.get_bytearray(), format)
 
     def get_bytearray(self):
+        if isinstance(self.bytes, str):
+            return self.bytes
         return ''.join([x for x in self.bytes])
 
     def get_hex(self):
@@ -30,6 +36,60 @@ class BasicBlock(BinaryObject):
     def __str__(self):
         return 'BasicBlock: at [' + hex(self.start_vaddr) + ', ' + hex(self.end_vaddr) + '], hex val: ' + self.get_hex()
 
+# Block of BasicBlockMap, same interface as BasicBlock
+class MappedBasicBlock(BasicBlock):
+
+    def __init__(self, start_vaddr, end_vaddr, content):
+        self.start_vaddr = start_vaddr
+        self.bytesize = end_vaddr - start_vaddr
+        self.end_vaddr = end_vaddr
+        self.bytes = content
+
+# Basic-block boundaries of .text, built once per binary from the linear sweep: a block ends after a jump, call or
+# return and starts at a direct branch target or function symbol. Blocks of the angr CFG refine it when they are
+# already recovered (whole-program CFG, or the functions RegionCallerAnalysis has recovered so far)
+# Replaces Binary.get_accurate_bb, which lifts up to 100 blocks backwards for each address
+class BasicBlockMap(object):
+
+    def __init__(self, binary):
+        self.binary = binary
+        text_section = binary.get_section(binary.get_text_section_name())
+        leaders = set([text_section.start_vaddr])
+        leaders.update([sym.vaddr for sym in binary.elf.symbols if sym.type == 2])
+        end = text_section.start_vaddr
+        for inst in binary.iter_text_disassembly():
+            end = inst.address + inst.size
+            if inst.group(X86_GRP_JUMP) or inst.group(X86_GRP_CALL) or inst.group(X86_GRP_RET):
+                leaders.add(end)
+                if len(inst.operands) == 1 and inst.operands[0].type == X86_OP_IMM:
+                    leaders.add(inst.operands[0].imm)
+
+        ca = binary.ca
+        if binary.has_angr_proj() and ca is not None and hasattr(ca, 'cfg'):
+            for fn in ca.cfg.functions.values():
+                for node in fn.graph.nodes():
+                    leaders.update([node.addr, node.addr + node.size])
+
+        # The sweep stops at the first undecodable bytes: addresses past it are not covered
+        self.start_vaddr = text_section.start_vaddr
+        self.end_vaddr = end
+        self.starts = sorted([a for a in leaders if self.start_vaddr <= a < end])
+        self.blocks = {}
+
+    def covers(self, vaddr):
+        return self.start_vaddr <= vaddr < self.end_vaddr
+
+    # Block containing vaddr, None if the sweep did not reach it
+    def lookup(self, vaddr):
+        if not self.covers(vaddr):
+            return None
+        i = bisect_right(self.starts, vaddr) - 1
+        if i not in self.blocks:
+            start = self.starts[i]
+            end = self.starts[i + 1] if i + 1 < len(self.starts) else self.end_vaddr
+            self.blocks[i] = MappedBasicBlock(start, end, self.binary.read_bytes(start, end - start))
+        return self.blocks[i]
+
 class SectionNotFoundException(Exception):
     pass
 
@@ -49,18 +109,39 @@ class Section(BinaryObject):
         return 'Section: ' + self.name + ' at [' + hex(self.start_vaddr) + ', ' + hex(self.end_vaddr) + ']'
 
 # Provide angr API and other stuff related to binary
-class Binary:
+# Sections, memory and disassembly come from a light ELF loader (elf_loader.py);
+# the angr project is only built when first needed (asserter, CFG, basic blocks)
+class Binary(object):
+    DISASM_CACHE_SIZE = 256
 
     def __init__(self, exec_path, load_libs=False, format="hex"):
-        self.angr_proj = angr.Project(exec_path, auto_load_libs=load_libs)
+        self.path = exec_path
+        self.load_libs = load_libs
+        self.elf = ElfFile(exec_path)
+        self._angr_proj = None
+        self.cs = None
         self.cache = {}
-        self.arch = self.angr_proj.arch.name
-        self.endian = self.angr_proj.arch.memory_endness[-2:]
-        self.min_addr = self.angr_proj.loader.min_addr
-        self.max_addr = self.angr_proj.loader.max_addr
+        self.arch = self.elf.arch
+        self.endian = self.elf.endian
+        self.min_addr = self.elf.min_addr
+        self.max_addr = self.elf.max_addr
         self.format = format
         self.ref_opcodes = {}
         self.ca = None
+        self.text_insts = None
+        self.text_inst_addrs = None
+        self.disasm_cache = {}
+        self.bb_map = None
+
+    @property
+    def angr_proj(self):
+        if self._angr_proj is None:
+            import angr
+            self._angr_proj = angr.Project(self.path, auto_load_libs=self.load_libs)
+        return self._angr_proj
+
+    def has_angr_proj(self):
+        return self._angr_proj is not None
 
     @staticmethod
     def get_text_section_name():
@@ -87,20 +168,101 @@ class Binary:
             return self.cache[section_name]
 
         try:
-            sec = self.angr_proj.loader.main_object.sections_map[section_name]
+            sec = self.elf.sections_map[section_name]
         except Exception as e:
             raise SectionNotFoundException("Section " + section_name + " not found: " + str(e))
 
-        content = self.angr_proj.loader.memory.read_bytes(sec.vaddr, sec.memsize)
+        content = self.elf.read_bytes(sec.vaddr, sec.memsize)
         section = Section(section_name, content, sec.vaddr, sec.memsize)
         self.cache[section_name] = section
         return section
 
+    # Capstone in AT&T syntax, as expected by ExpandLocalBuffer
+    def get_capstone(self):
+        if self.cs is None:
+            self.cs = Cs(CS_ARCH_X86, CS_MODE_64)
+            self.cs.detail = True
+            self.cs.syntax = CS_OPT_SYNTAX_ATT
+        return self.cs
+
+    def get_keystone(self):
+        from keystone import Ks, KS_ARCH_X86, KS_MODE_64
+        return Ks(KS_ARCH_X86, KS_MODE_64)
+
+    # Linear-sweep disassembly of .text, not kept under a memory budget (see get_text_disassembly)
+    def iter_text_disassembly(self):
+        if self.text_insts is not None or not BUDGET.enabled:
+            return iter(self.get_text_disassembly())
+        text_section = self.get_section(self.get_text_section_name())
+        return self.get_capstone().disasm(bytearray(text_section.get_bytearray()), text_section.start_vaddr)
+
+    # Linear-sweep disassembly of .text, done once and shared by CallerAnalysis, AngrCallerAnalysis and ExpandLocalBuffer
+    def get_text_disassembly(self):
+        if self.text_insts is None:
+            text_section = self.get_section(self.get_text_section_name())
+            self.text_insts = list(self.get_capstone().disasm(bytearray(text_section.get_bytearray()), text_section.start_vaddr))
+            self.text_inst_addrs = [inst.address for inst in self.text_insts]
+        return self.text_insts
+
+    # Return instructions in [start_vaddr, end_vaddr)
+    # Slice the .text disassembly if the sweep is in sync at start_vaddr, otherwise disassemble (and cache) the range
+    # Under a memory budget (memory_budget.py) the .text disassembly is not kept and ranges are disassembled on demand
+    def disasm(self, start_vaddr, end_vaddr):
+        if BUDGET.enabled and self.text_insts is None:
+            key = (start_vaddr, end_vaddr)
+            if key not in self.disasm_cache:
+                if len(self.disasm_cache) >= self.DISASM_CACHE_SIZE:
+                    self.disasm_cache.clear()
+                content = self.read_bytes(start_vaddr, end_vaddr - start_vaddr)
+                self.disasm_cache[key] = list(self.get_capstone().disasm(bytearray(content), start_vaddr))
+            return self.disasm_cache[key]
+
+        insts = self.get_text_disassembly()
+        lo = bisect_left(self.text_inst_addrs, start_vaddr)
+        if lo < len(insts) and insts[lo].address == start_vaddr:
+            hi = bisect_left(self.text_inst_addrs, end_vaddr, lo)
+            return insts[lo:hi]
+
+        key = (start_vaddr, end_vaddr)
+        if key not in self.disasm_cache:
+            content = self.read_bytes(start_vaddr, end_vaddr - start_vaddr)
+            self.disasm_cache[key] = list(self.get_capstone().disasm(bytearray(content), start_vaddr))
+        return self.disasm_cache[key]
+
+    # Drop what can be rebuilt on demand, e.g. between detection and rewriting
+    def release_transient(self, keep_angr=True):
+        self.text_insts = None
+        self.text_inst_addrs = None
+        self.disasm_cache = {}
+        self.cache = {}
+        self.bb_map = None
+        if not keep_angr:
+            self._angr_proj = None
+            if self.ca is not None and hasattr(self.ca, 'release_angr'):
+                self.ca.release_angr()
+
+    # {name: structure} for MemoryBudget.report
+    def footprints(self):
+        out = {'sections': self.cache, 'text disassembly': self.text_insts, 'disasm cache': self.disasm_cache,
+               'basic-block map': self.bb_map.starts if self.bb_map is not None else None}
+        if self.ca is not None and hasattr(self.ca, 'footprints'):
+            out.update(self.ca.footprints())
+        return out
+
+    def read_bytes(self, vaddr, bytesize):
+        return self.elf.read_bytes(vaddr, bytesize)
+
     # Return simple basic block starting from addr
     def get_bb(self, addr):
         return BasicBlock(self.angr_proj.factory.block(addr))
 
 
+    # Block containing addr from the basic-block map (built on first use), None if addr is not covered by it
+    def get_mapped_bb(self, addr):
+        if self.bb_map is None:
+            self.bb_map = BasicBlockMap(self)
+        return self.bb_map.lookup(addr)
+
     # Given the addr, angr API seems to be able to find the correct end_addr of BB
     # BUT, it may not return the correct start_addr
     # Idea: we keep decrementing addr until end_addr becomes differet
@@ -134,23 +296,6 @@ class Binary:
         return out_block
 
 
-    def sweep_search(self, absolute_vaddrs, str_format):
-        queries = []
-
-        for addr in absolute_vaddrs:
-            query = format(addr, 'x')
-
-            if self.endian == "LE":
-                query = flip_str_endian(query)
-            queries.append(parse_hex(query, str_format))
-
-        text_section = self.get_section(self.get_text_section_name())
-        text_section_val = text_section.get_val(str_format)
-        answer = search(text_section_val, queries)
-        caller_addrs = [ (idx_to_bytes(item, str_format)+text_section.start_vaddr) for sublist in answer.values() for item in sublist]
-        return list(set(caller_addrs))
-
-
 if __name__ == "__main__":
     bin = Binary('../testbench/bin/hash/sha1.o')
     print 'Binary at adddr: [' + hex(bin.min_addr) + ', ' + hex(bin.max_addr) + ']'
@@ -165,4 +310,5 @@ if __name__ == "__main__":
     print bb
 
     acc_bb = bin.get_accurate_bb(addr)
-    print acc_bb
\ No newline at end of file
+    print acc_bb
+    print bin.get_mapped_bb(addr)
\ No newline at end of file
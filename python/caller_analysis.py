@@ -1,78 +1,117 @@
 from abstract_caller_analysis import AbstractCallerAnalysis
+from memory_budget import BUDGET
+import array
 import numpy as np
+from capstone.x86 import X86_OP_IMM, X86_OP_MEM, X86_REG_RIP
 from instruction import *
 
+INDEX_KINDS = ['call', 'ret', 'lea', 'movdqa']
+
+# Entry of the instruction index, with what search_insts callers use of an instruction
+class IndexedInst:
+
+    def __init__(self, kind, base_vaddr, target):
+        self.kind = kind
+        self.base_vaddr = base_vaddr
+        self.target = target
+
+    def name(self):
+        return self.kind
+
+    def get_target_absolute_addr(self):
+        return self.target
+
 class CallerAnalysis(AbstractCallerAnalysis):
 
     def __init__(self, binary, deepcopy=False):
         self.disassembly = None
         self.insts = None
+        self.sorted_call_targets = None
         #self.binary = binary
         super(CallerAnalysis, self).__init__(binary, deepcopy)
         self.gather_all_insts()
 
-    # Detect by scanning the binary with respect to absolute addrs
-    # And LEA instructions
+    # Instructions referencing data in [start_vaddr, end_vaddr) (only start_vaddr if end_vaddr is None):
+    # absolute imm32/disp32 operands and RIP-relative targets, looked up in the data-xref index
     def data_refs(self, start_vaddr, end_vaddr=None):
-        callers = []
         if end_vaddr is None:
-            end_vaddr = start_vaddr
-
-        callers += self.binary.sweep_search(xrange(start_vaddr, end_vaddr), self.binary.format)
-        insts = self.search_insts([LongLeaInst.name()], lambda x: x>=start_vaddr and x<=end_vaddr)
-        callers += [inst.base_vaddr for inst in insts]
-        insts = self.search_insts([MovdqaInst.name()], lambda x: x>=start_vaddr and x<=end_vaddr)
-        callers += [inst.base_vaddr for inst in insts]
-
-        return callers
+            end_vaddr = start_vaddr + 1
+        lo = np.searchsorted(self.xref_targets, start_vaddr, side='left')
+        hi = np.searchsorted(self.xref_targets, end_vaddr, side='left')
+        return sorted(set(self.xref_insts[lo:hi].tolist()))
 
     def code_refs(self, vaddr):
         # return [inst.base_vaddr for inst in self.search_insts([LongLeaInst.name(), CallInst.name()], lambda x: x==vaddr)]
         return [inst.base_vaddr for inst in self.search_insts([CallInst.name()], lambda x: x==vaddr)]
 
     def disasm(self):
-        section_name = self.binary.get_text_section_name()
-        try:
-            sec = self.binary.angr_proj.loader.main_object.sections_map[section_name]
-        except Exception as e:
-            raise SectionNotFoundException("Section " + section_name + " not found: " + str(e))
-
-        content = self.binary.angr_proj.loader.memory.read_bytes(sec.vaddr, sec.memsize)
-        self.disassembly = self.binary.angr_proj.arch.capstone.disasm(bytearray(content), sec.vaddr)
+        self.disassembly = self.binary.get_text_disassembly()
 
+    # Index kind/address/target of every call, ret, lea and movdqa of .text as arrays
+    # (spilled to disk under a memory budget) rather than one Python object per instruction
+    # The same pass builds the data-xref index: every operand address inside the binary, with the instruction
+    # using it, sorted by address
     def gather_all_insts(self):
-        if self.disassembly is None:
-            self.disasm()
-
-        self.insts = []
-        for inst in self.disassembly:
-            vaddr = inst.address
-            #if inst.address == 0x406387:
-            #    raise TypeError('inst: '+inst.insn_name()+ ' '+str(inst)+' '+hex(inst.address))
-            inst = InstructionFactory.create_instruction(inst)
-            #if vaddr == 0x406387:
-            #    raise TypeError('inst: '+str(inst)+' abs disp '+hex(inst.get_target_absolute_addr()))
-
+        kinds = array.array('b')
+        bases = array.array('l')
+        targets = array.array('l')
+        xref_targets = array.array('l')
+        xref_insts = array.array('l')
+        min_addr, max_addr = self.binary.min_addr, self.binary.max_addr
+        for cs_inst in self.binary.iter_text_disassembly():
+            for op in cs_inst.operands:
+                if op.type == X86_OP_IMM:
+                    target = op.imm
+                elif op.type == X86_OP_MEM and op.mem.base == X86_REG_RIP:
+                    target = cs_inst.address + cs_inst.size + op.mem.disp
+                elif op.type == X86_OP_MEM:
+                    target = op.mem.disp
+                else:
+                    continue
+                if min_addr <= target < max_addr:
+                    xref_targets.append(target)
+                    xref_insts.append(cs_inst.address)
+
+            inst = InstructionFactory.create_instruction(cs_inst)
             if inst is not None:
-                self.insts.append(inst)
+                kinds.append(INDEX_KINDS.index(inst.name()))
+                bases.append(inst.base_vaddr)
+                targets.append(inst.get_target_absolute_addr())
+
+        self.inst_kinds = BUDGET.spill('inst_kinds', np.frombuffer(kinds.tostring(), dtype=np.int8))
+        self.inst_bases = BUDGET.spill('inst_bases', np.frombuffer(bases.tostring(), dtype=np.int64))
+        self.inst_targets = BUDGET.spill('inst_targets', np.frombuffer(targets.tostring(), dtype=np.int64))
+
+        xref_targets = np.frombuffer(xref_targets.tostring(), dtype=np.int64)
+        xref_insts = np.frombuffer(xref_insts.tostring(), dtype=np.int64)
+        order = np.argsort(xref_targets, kind='mergesort')
+        self.xref_targets = BUDGET.spill('xref_targets', xref_targets[order])
+        self.xref_insts = BUDGET.spill('xref_insts', xref_insts[order])
 
 
     # Filter instructions whose fun(target addr) is true
     def search_insts(self, names, fun):
         insts = []
 
-        for inst in self.insts:
-            if inst.name() in names and fun(inst.get_target_absolute_addr()):
-                insts.append(inst)
+        codes = [INDEX_KINDS.index(n) for n in names if n in INDEX_KINDS]
+        idx = np.nonzero(np.in1d(self.inst_kinds, codes))[0]
+        for kind, base, target in zip(self.inst_kinds[idx].tolist(), self.inst_bases[idx].tolist(), self.inst_targets[idx].tolist()):
+            if fun(target):
+                insts.append(IndexedInst(INDEX_KINDS[kind], base, target))
 
         return insts
 
+    def footprints(self):
+        return {'inst index': [self.inst_kinds, self.inst_bases, self.inst_targets],
+                'data-xref index': [self.xref_targets, self.xref_insts]}
+
     def get_func_scope(self, vaddr):
         text_section = self.binary.get_section(self.binary.get_text_section_name())
-        # insts = self.search_insts([LongLeaInst.name(), CallInst.name()], lambda x: x>=text_section.start_vaddr and x<=text_section.end_vaddr)
-        insts = self.search_insts([CallInst.name()], lambda x: x>=text_section.start_vaddr and x<=text_section.end_vaddr)
-        sorted_addrs = [inst.get_target_absolute_addr() for inst in insts]
-        sorted_addrs.sort()
+        if self.sorted_call_targets is None:
+            # insts = self.search_insts([LongLeaInst.name(), CallInst.name()], lambda x: x>=text_section.start_vaddr and x<=text_section.end_vaddr)
+            insts = self.search_insts([CallInst.name()], lambda x: x>=text_section.start_vaddr and x<=text_section.end_vaddr)
+            self.sorted_call_targets = sorted([inst.get_target_absolute_addr() for inst in insts])
+        sorted_addrs = self.sorted_call_targets
         addr_idx = np.searchsorted(sorted_addrs, vaddr)
         entry_addr = text_section.start_vaddr if addr_idx == 0 else sorted_addrs[addr_idx - 1]
         exit_addr = text_section.end_vaddr if addr_idx == len(sorted_addrs) else sorted_addrs[addr_idx]
@@ -92,8 +131,8 @@ if __name__ == "__main__":
 
     cda = CallerAnalysis(Binary('../testbench/bin/hash/md2.o'))
 
-    for d in cda.insts:
-        print d.name(), hex(d.base_vaddr), hex(d.get_target_relative_addr()), hex(d.get_target_absolute_addr())
+    for d in cda.search_insts(INDEX_KINDS, lambda x: True):
+        print d.name(), hex(d.base_vaddr), hex(d.get_target_absolute_addr())
 
     callers = cda.data_refs(0x400a80, 0x400b83)
     assert (set(callers) == {0x400678, 0x4009a3, 0x400705})
@@ -0,0 +1,120 @@
+from capstone.x86 import *
+from alice_logger import AliceLog
+
+Log = AliceLog['main']
+
+# System V argument registers used by the hash signatures (see generate_all_possible_args)
+ARG_REGS = {
+    X86_REG_RDI: X86_REG_RDI, X86_REG_EDI: X86_REG_RDI, X86_REG_DI: X86_REG_RDI, X86_REG_DIL: X86_REG_RDI,
+    X86_REG_RSI: X86_REG_RSI, X86_REG_ESI: X86_REG_RSI, X86_REG_SI: X86_REG_RSI, X86_REG_SIL: X86_REG_RSI,
+    X86_REG_RDX: X86_REG_RDX, X86_REG_EDX: X86_REG_RDX, X86_REG_DX: X86_REG_RDX, X86_REG_DL: X86_REG_RDX, X86_REG_DH: X86_REG_RDX,
+}
+
+# Smallest stack frame that can hold an MD5/SHA-1 context (md5_ctx, SHA_CTX, ...)
+MIN_CTX_FRAME = 0x58
+MAX_ONE_SHOT_INSTS = 2000
+
+
+class CandidateFeatures:
+
+    def __init__(self, entry):
+        self.entry = entry
+        self.arg_regs = set()
+        self.calls_transform = 0   # 2 if it calls a transform directly, 1 through one more call
+        self.is_transform = False
+        self.frame_size = 0
+        self.num_insts = 0
+        self.score = 0
+
+    def num_args(self):
+        return len(self.arg_regs)
+
+    def __repr__(self):
+        return 'Candidate: %#x score: %d args: %d calls_transform: %d frame: %#x insts: %d' % \
+            (self.entry, self.score, self.num_args(), self.calls_transform, self.frame_size, self.num_insts)
+
+
+# Cheap static pre-filter for asserter candidates (output of get_hierarchical_scopes)
+# Candidates are ranked so the likely one-shot hash entry points are emulated first,
+# and dropped for signatures that need more argument registers than they use
+class CandidateRanker:
+
+    def __init__(self, binary):
+        self.binary = binary
+        self.callees = {}
+
+    def _insts(self, entry):
+        fn_start, fn_end = self.binary.ca.get_func_scope(entry)
+        return self.binary.disasm(entry, fn_end)
+
+    def get_callees(self, entry):
+        if entry not in self.callees:
+            out = set()
+            try:
+                for inst in self._insts(entry):
+                    if inst.group(X86_GRP_CALL) and len(inst.operands) == 1 and inst.operands[0].type == X86_OP_IMM:
+                        out.add(inst.operands[0].imm)
+            except Exception as e:
+                Log.debug('Cannot get callees of %#x: %s', entry, e)
+            self.callees[entry] = out
+        return self.callees[entry]
+
+    def features(self, entry, transforms):
+        f = CandidateFeatures(entry)
+        insts = self._insts(entry)
+        f.num_insts = len(insts)
+        f.is_transform = entry in transforms
+
+        callees = self.get_callees(entry)
+        if callees & transforms:
+            f.calls_transform = 2
+        elif any([self.get_callees(c) & transforms for c in callees]):
+            f.calls_transform = 1
+
+        # Argument registers read before being written. At the first call/jmp out, the ones not written yet
+        # are assumed to be passed through
+        written = set()
+        for i, inst in enumerate(insts):
+            if inst.group(X86_GRP_CALL) or inst.group(X86_GRP_JUMP) or inst.group(X86_GRP_RET):
+                f.arg_regs |= set(ARG_REGS.values()) - written
+                break
+            regs_read, regs_write = inst.regs_access()
+            # xor %edx, %edx only writes
+            if inst.mnemonic.startswith('xor') and len(inst.operands) == 2 and inst.operands[0].type == X86_OP_REG \
+                    and inst.operands[1].type == X86_OP_REG and inst.operands[0].reg == inst.operands[1].reg:
+                regs_read = []
+            for r in regs_read:
+                if r in ARG_REGS and ARG_REGS[r] not in written:
+                    f.arg_regs.add(ARG_REGS[r])
+            for r in regs_write:
+                if r in ARG_REGS:
+                    written.add(ARG_REGS[r])
+
+            # Frame size from the prologue: sub $imm, %rsp
+            if i < 16 and f.frame_size == 0 and inst.mnemonic.startswith('sub') and len(inst.operands) == 2 \
+                    and inst.operands[1].type == X86_OP_REG and inst.operands[1].reg == X86_REG_RSP \
+                    and inst.operands[0].type == X86_OP_IMM:
+                f.frame_size = inst.operands[0].imm
+
+        f.score = 4*f.calls_transform + (1 if f.is_transform else 0) + (2 if f.frame_size >= MIN_CTX_FRAME else 0) \
+            + (1 if f.num_args() >= 2 else -4) - (2 if f.num_insts > MAX_ONE_SHOT_INSTS else 0)
+        return f
+
+    # Return {entry: CandidateFeatures}; with ``prune", entries that seem to take fewer than two arguments are dropped
+    def rank(self, entries, transforms, prune=False):
+        out = {}
+        transforms = set(transforms)
+        for entry in entries:
+            try:
+                f = self.features(entry, transforms)
+            except Exception as e:
+                Log.debug('Cannot rank %#x: %s', entry, e)
+                f = CandidateFeatures(entry)
+                f.arg_regs = set(ARG_REGS.values())
+            if prune and f.num_args() < 2:
+                Log.debug('Pruned: %s', f)
+                continue
+            Log.debug('%s', f)
+            out[entry] = f
+        Log.info('Candidate ranking: ' + str(len(out)) + ' of ' + str(len(entries)) + ' candidate(s) kept')
+        return out
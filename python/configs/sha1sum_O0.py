@@ -13,3 +13,8 @@ patch = SHA256Patch # Containing a more secure crypto primitive
 triton_cmdline = "/home/osboxes/oak/pin-2.14-71313-gcc.4.4.7-linux/source/tools/Triton/build/triton /home/osboxes/oak/code/python/taint_triton_pin.py /home/osboxes/oak/code/testcases/coreutils-5.2.1/bin/sha1sum_O0 --string oakoakoak" # Containing how Triton (taint analysis tool) will be called on target executable
 
 fns = [] # Only needed if addresses in force_insts are not in the rewritten functions. Ideally, it should be empty. If not, it should be in the form of [(start_fn_addr, end_fn_addr)]
+
+# Optional: several scoping inputs, traced concurrently and merged (overrides triton_cmdline). Each entry is a command line
+# or a dict {'cmdline': ..., 'stdin': path, 'replay': command run alongside, 'replay_delay': seconds, 'group': key}.
+# Inputs with the same cmdline or group run one after the other (e.g. server instances listening on the same port), e.g.
+#scope_inputs = [triton_cmdline, {'cmdline': triton_cmdline.replace(' --string oakoakoak', ' -'), 'stdin': '/etc/hostname'}]
@@ -0,0 +1,107 @@
+from func_args import *
+from desc import GLOBAL_INPUT, GLOBAL_INPUT_LEN
+from alice_trace import TRACER
+from execution_budget import ExecutionAborted, ExecutionTimedOut
+
+# Sits in front of an asserter (CryptoAsserter/NativeAsserter, same interface) and executes each candidate once per
+# argument layout. All hash descriptors use GLOBAL_INPUT, so the output of that single execution is matched against
+# the digests of all of them: candidates shared by primitives with the same constants (md5/md4, sha1/ripemd160)
+# are not executed again when the next primitive is searched, and a candidate producing another primitive's
+# digest is attributed to that primitive (matched())
+class DigestClassifier:
+
+    def __init__(self, asserter, descs):
+        self.asserter = asserter
+        self.digests = [(d, d.sample_ios[0]['output'].decode('hex')) for d in descs
+                        if d.sample_ios and d.sample_ios[0]['input'] == GLOBAL_INPUT and d.sample_ios[0]['input-len'] == GLOBAL_INPUT_LEN]
+        # Large enough for every digest
+        self.out_bytelen = len(GLOBAL_INPUT)
+        self.runs = {}      # (entry, layout) -> {arg index: output} or the exception it raised
+        self.probes = {}    # (entry, input, in_len, buf_addr) -> probe_outputs() result
+        self.executions = 0
+
+    @staticmethod
+    def layout(argv):
+        return tuple([(a.type, a.val, a.ref_val) for a in argv])
+
+    def _outputs(self, entry, argv):
+        key = (entry, self.layout(argv))
+        if key not in self.runs:
+            self.executions += 1
+            TRACER.count('candidate_executions')
+            run_argv = [a.copy() for a in argv]
+            for a in run_argv:
+                if a.type == AliceArg.TYPE_BYTE_POINTER:
+                    a.expected_output = ''      # read back every buffer
+            try:
+                run_argv = self.asserter.execute_fn(entry, self.out_bytelen, run_argv)
+                self.runs[key] = dict([(i, a.output) for i, a in enumerate(run_argv) if a.output is not None])
+            except Exception as e:
+                self.runs[key] = e
+        if isinstance(self.runs[key], Exception):
+            raise self.runs[key]
+        return self.runs[key]
+
+    # Same interface as CryptoAsserter
+    def assert_fn(self, fn_addr, out_bytelen, argv):
+        outputs = self._outputs(fn_addr, argv)
+        for i, arg in enumerate(argv):
+            if arg.expected_output is not None and outputs[i][:out_bytelen] != arg.expected_output[:out_bytelen]:
+                return False
+        return True
+
+    def execute_fn(self, fn_addr, out_bytelen, argv):
+        outputs = self._outputs(fn_addr, argv)
+        for i, arg in enumerate(argv):
+            if arg.expected_output is not None:
+                arg.output = outputs[i][:out_bytelen]
+        return argv
+
+    def probe_signature(self, fn_addr, out_bytelen, in_bytes, in_len, expected_output, buf_addr=0x200):
+        key = (fn_addr, in_bytes, in_len, buf_addr)
+        if key not in self.probes:
+            self.executions += 1
+            TRACER.count('candidate_executions')
+            self.probes[key] = self.asserter.probe_outputs(fn_addr, self.out_bytelen, in_bytes, in_len, buf_addr)
+        if not self.probes[key]:
+            return self.probes[key]
+        return probe_match(self.probes[key], expected_output[:out_bytelen])
+
+    # [(entry, signature name)] of every executed candidate whose output is the digest of ``desc"
+    # all_argvs: generate_all_possible_args() for desc
+    def matched(self, desc, all_argvs):
+        digest = dict(self.digests).get(desc)
+        if digest is None:
+            return []
+        out = []
+        names = dict([(self.layout(argv), name) for name, argv in all_argvs.items()])
+        for (entry, layout), outputs in self.runs.items():
+            if layout not in names or isinstance(outputs, Exception):
+                continue
+            argv = all_argvs[names[layout]]
+            if all([outputs[i][:desc.digest_size] == digest for i, a in enumerate(argv) if a.expected_output is not None]):
+                out.append((entry, names[layout]))
+        for (entry, _, _, _), result in self.probes.items():
+            if result:
+                name = probe_match(result, digest)
+                if name and name in all_argvs:
+                    out.append((entry, name))
+        return sorted(set(out))
+
+    # All (entry, signature name) executed so far that have a verdict: ran to completion or hit the execution budget.
+    # Runs that failed for another reason (asserter or environment error, wall-clock timeout) are left out
+    def executed(self, all_argvs):
+        names = dict([(self.layout(argv), name) for name, argv in all_argvs.items()])
+        out = set([(entry, names[layout]) for (entry, layout), outputs in self.runs.items() if layout in names
+                   and (not isinstance(outputs, Exception) or
+                                                                  (isinstance(outputs, ExecutionAborted) and not isinstance(outputs, ExecutionTimedOut)))])
+        for (entry, _, _, _), result in self.probes.items():
+            if result is not None:
+                out.update([(entry, name) for name in all_argvs.keys()])
+        return out
+
+    def descs(self):
+        return [d for d, _ in self.digests]
+
+    def close(self):
+        self.asserter.close()
@@ -0,0 +1,158 @@
+import mmap
+import struct
+
+# Minimal read-only ELF64 (x86-64, little-endian) loader
+# Gives Binary the sections, segments, symbols and memory of the main object without loading angr,
+# which takes seconds and hundreds of MB for large binaries
+
+EM_X86_64 = 0x3e
+PT_LOAD = 1
+SHT_SYMTAB = 2
+SHT_NOBITS = 8
+SHT_DYNSYM = 11
+SHF_ALLOC = 0x2
+
+class ElfFormatError(Exception):
+    pass
+
+class UnmappedAddressError(Exception):
+    pass
+
+def _cstr(data, offset):
+    end = data.find('\0', offset)
+    return data[offset:end]
+
+
+class ElfSection:
+
+    def __init__(self, name, sh_type, flags, vaddr, offset, size):
+        self.name = name
+        self.type = sh_type
+        self.flags = flags
+        self.vaddr = vaddr
+        self.offset = offset
+        self.memsize = size
+
+    def contains_addr(self, addr):
+        return self.vaddr <= addr < self.vaddr + self.memsize
+
+    def __str__(self):
+        return 'ElfSection: ' + self.name + ' at [' + hex(self.vaddr) + ', ' + hex(self.vaddr+self.memsize) + ']'
+
+
+class ElfSegment:
+
+    def __init__(self, p_type, flags, offset, vaddr, filesz, memsz):
+        self.type = p_type
+        self.flags = flags
+        self.offset = offset
+        self.vaddr = vaddr
+        self.filesz = filesz
+        self.memsz = memsz
+
+    def contains_addr(self, addr):
+        return self.vaddr <= addr < self.vaddr + self.memsz
+
+
+class ElfSymbol:
+
+    def __init__(self, name, vaddr, size, sym_type):
+        self.name = name
+        self.vaddr = vaddr
+        self.size = size
+        self.type = sym_type
+
+
+class ElfFile(object):
+
+    def __init__(self, path):
+        self.path = path
+        with open(path, 'rb') as f:
+            self.data = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+
+        if self.data[:4] != '\x7fELF':
+            raise ElfFormatError(path + ' is not an ELF file')
+        if ord(self.data[4]) != 2 or ord(self.data[5]) != 1:
+            raise ElfFormatError(path + ': only ELF64 little-endian is supported')
+
+        (self.e_type, self.e_machine, _, self.entry, e_phoff, e_shoff, _, _, e_phentsize, e_phnum,
+         e_shentsize, e_shnum, e_shstrndx) = struct.unpack_from('<HHIQQQIHHHHHH', self.data, 16)
+        if self.e_machine != EM_X86_64:
+            raise ElfFormatError(path + ': unsupported machine %#x' % self.e_machine)
+        self.arch = 'AMD64'
+        self.endian = 'LE'
+
+        self.segments = []
+        for i in xrange(e_phnum):
+            p_type, p_flags, p_offset, p_vaddr, _, p_filesz, p_memsz, _ = struct.unpack_from('<IIQQQQQQ', self.data, e_phoff + i*e_phentsize)
+            self.segments.append(ElfSegment(p_type, p_flags, p_offset, p_vaddr, p_filesz, p_memsz))
+        self.load_segments = sorted([s for s in self.segments if s.type == PT_LOAD], key=lambda s: s.vaddr)
+        if not self.load_segments:
+            raise ElfFormatError(path + ': no loadable segment')
+        self.min_addr = self.load_segments[0].vaddr
+        self.max_addr = max([s.vaddr + s.memsz for s in self.load_segments]) - 1
+
+        headers = []
+        for i in xrange(e_shnum):
+            headers.append(struct.unpack_from('<IIQQQQIIQQ', self.data, e_shoff + i*e_shentsize))
+        self.section_headers = headers
+        names_offset = headers[e_shstrndx][4] if e_shstrndx < len(headers) else None
+        self.sections = []
+        self.sections_map = {}
+        for sh_name, sh_type, sh_flags, sh_addr, sh_offset, sh_size, _, _, _, _ in headers:
+            name = _cstr(self.data, names_offset + sh_name) if names_offset is not None else ''
+            sec = ElfSection(name, sh_type, sh_flags, sh_addr, sh_offset, sh_size)
+            self.sections.append(sec)
+            if name:
+                self.sections_map[name] = sec
+        self._symbols = None
+
+    # Read-only mapping, shared by copies of Binary
+    def __deepcopy__(self, memo):
+        return self
+
+    # Symbols of .symtab and .dynsym, parsed on first use
+    @property
+    def symbols(self):
+        if self._symbols is None:
+            self._symbols = []
+            for sh_name, sh_type, _, _, sh_offset, sh_size, sh_link, _, _, sh_entsize in self.section_headers:
+                if sh_type not in (SHT_SYMTAB, SHT_DYNSYM) or not sh_entsize:
+                    continue
+                str_offset = self.section_headers[sh_link][4]
+                for i in xrange(sh_size/sh_entsize):
+                    st_name, st_info, _, _, st_value, st_size = struct.unpack_from('<IBBHQQ', self.data, sh_offset + i*sh_entsize)
+                    if st_name:
+                        self._symbols.append(ElfSymbol(_cstr(self.data, str_offset + st_name), st_value, st_size, st_info & 0xf))
+        return self._symbols
+
+    def get_symbol(self, name):
+        for sym in self.symbols:
+            if sym.name == name:
+                return sym
+        return None
+
+    def find_segment(self, vaddr):
+        for seg in self.load_segments:
+            if seg.contains_addr(vaddr):
+                return seg
+        return None
+
+    # Bytes as mapped by the loader: file-backed part of each PT_LOAD segment, zeros past p_filesz
+    def read_bytes(self, vaddr, bytesize):
+        out = []
+        while bytesize > 0:
+            seg = self.find_segment(vaddr)
+            if seg is None:
+                raise UnmappedAddressError('Address %#x is not mapped' % vaddr)
+            n = min(bytesize, seg.vaddr + seg.memsz - vaddr)
+            off = vaddr - seg.vaddr
+            file_n = max(0, min(n, seg.filesz - off))
+            out.append(self.data[seg.offset + off:seg.offset + off + file_n])
+            out.append('\0' * (n - file_n))
+            vaddr += n
+            bytesize -= n
+        return ''.join(out)
+
+    def close(self):
+        self.data.close()
@@ -0,0 +1,20 @@
+# Raised when a candidate exceeds its ExecutionBudget or does something a hash function does not do
+class ExecutionAborted(Exception):
+    pass
+
+# Raised when a candidate runs over a wall-clock timeout (NativeAsserter): depends on machine load, so it is not a
+# verdict and is never cached
+class ExecutionTimedOut(ExecutionAborted):
+    pass
+
+# Deterministic limits on candidate execution, so non-hash candidates are rejected after a few
+# thousand instructions instead of a wall-clock timeout, and verdicts do not depend on machine load
+class ExecutionBudget:
+
+    def __init__(self, max_insts=200000, max_blocks=2000, stack_size=0x100000, abort_on_stub=True):
+        self.max_insts = max_insts
+        self.max_blocks = max_blocks
+        self.stack_size = stack_size
+        self.abort_on_stub = abort_on_stub
+
+DEFAULT_BUDGET = ExecutionBudget()
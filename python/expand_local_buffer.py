@@ -6,6 +6,7 @@ from keystone import *
 from expand_tainted_buffer import *
 from expand_static_buffer import *
 from alice_logger import ScoperLog
+from alice_trace import TRACER
 import operator
 
 Log = ScoperLog
@@ -18,6 +19,8 @@ class RewriteError(Exception):
 ELB_SRC_REG = 0
 ELB_DST_REG = 1
 
+NOP_OPCODE = 0x90
+
 def op_pc_disp(op):
     if op.type == X86_OP_MEM and op.mem.base == X86_REG_RIP:
         return op.mem.disp
@@ -177,8 +180,11 @@ class ExpandLocalBufferPatch:
         self.NUM_ELB_PATCHES += 1
         self.label_prefix = label_prefix + str(self.NUM_ELB_PATCHES) + '_'
         self.label_num = label_num
-        self.ks = Ks(self.elb.binary.angr_proj.arch.ks_arch, self.elb.binary.angr_proj.arch.ks_mode)
+        self.ks = self.elb.binary.get_keystone()
         self.ks.syntax = KS_OPT_SYNTAX_ATT
+        self.cs = self.elb.binary.get_capstone()
+        # (asm, addr) -> encoding, kept across rewriter passes
+        self.encodings = {}
         self.assembly = None
         self.start_addr = 0
         self.labels = self.assign_labels()
@@ -191,12 +197,65 @@ class ExpandLocalBufferPatch:
         if assembly is None:
             assembly = self.new_assembly
         
-        for asm in assembly:
-            tmp = self.asm_single_inst(asm, ip)
+        for asm, tmp in zip(assembly, self.assemble(assembly, ip)):
             Log.info(hex(ip) + ": " + asm)
             ip += len(tmp)
 
+    # Keystone mis-encodes these, they are always assembled (or hardcoded) one at a time
+    @staticmethod
+    def is_special_asm(asm):
+        return 'fs' in asm or 'rep' in asm
+
+    # Assemble a list of instructions laid out from addr, return the encoding of each instruction
+    # Runs of regular instructions go through keystone as a single unit and are split back with capstone
+    def assemble(self, assembly, addr):
+        out = []
+        ip = addr
+        i = 0
+        while i < len(assembly):
+            j = i + 1
+            if self.is_special_asm(assembly[i]) or (assembly[i], ip) in self.encodings:
+                encodings = [self.asm_single_inst(assembly[i], ip)]
+            else:
+                while j < len(assembly) and not self.is_special_asm(assembly[j]):
+                    j += 1
+                encodings = self.asm_unit(assembly[i:j], ip)
+            for encoding in encodings:
+                ip += len(encoding)
+            out.extend(encodings)
+            i = j
+        return out
+
+    def asm_unit(self, assembly, addr):
+        if len(assembly) > 1:
+            try:
+                encoding, count = self.ks.asm('\n'.join(assembly), addr=addr)
+            except Exception as e:
+                encoding, count = None, 0
+            if count == len(assembly):
+                insts = list(self.cs.disasm(str(bytearray(encoding)), addr))
+                if len(insts) == len(assembly) and sum([inst.size for inst in insts]) == len(encoding):
+                    out = []
+                    for asm, inst in zip(assembly, insts):
+                        self.encodings[(asm, inst.address)] = list(inst.bytes)
+                        out.append(list(inst.bytes))
+                    return out
+            Log.debug('Cannot assemble ' + str(len(assembly)) + ' inst(s) at ' + hex(addr) + ' as a unit, falling back to single instructions')
+
+        out = []
+        ip = addr
+        for asm in assembly:
+            out.append(self.asm_single_inst(asm, ip))
+            ip += len(out[-1])
+        return out
+
     def asm_single_inst(self, asm, addr=0):
+        key = (asm, addr)
+        if key not in self.encodings:
+            self.encodings[key] = self._asm_single_inst(asm, addr)
+        return self.encodings[key]
+
+    def _asm_single_inst(self, asm, addr=0):
         if 'fs' in asm:
             Log.warning("FS register, asm inst: "+str(asm))
             if asm == 'movq %fs:0x28, %rax':
@@ -238,11 +297,8 @@ class ExpandLocalBufferPatch:
 
 
     def compile(self):
-        ip = self.start_addr
         out = []
-        for asm in self.new_assembly:
-            tmp = self.asm_single_inst(asm, ip)
-            ip += len(tmp)
+        for tmp in self.assemble(self.new_assembly, self.start_addr):
             out.extend(tmp)
         return bytearray(out)
 
@@ -290,13 +346,7 @@ class ExpandLocalBufferPatch:
                 new_assembly = self.elb.mod_assembly[inst.address]
 
             # Replace all data mapping
-            for old_addr, new_addr in self.data_mapping.items():
-                old_addr = int(old_addr)
-                new_addr = int(new_addr)
-                if hex(old_addr) in new_assembly:
-                    old_new_assembly = new_assembly
-                    new_assembly = replace_disp(new_assembly, old_addr, new_addr, False)
-                    Log.debug('Data access changes: ' + new_assembly + '--------->' + old_new_assembly)
+            new_assembly = self.map_data(new_assembly)
                     
             # Assign label to that absolute address
             if (inst.group(X86_GRP_JUMP) or inst.group(X86_GRP_CALL)) and len(inst.operands) == 1 \
@@ -312,7 +362,7 @@ class ExpandLocalBufferPatch:
                 encoding = self.asm_single_inst(new_assembly, addr=ip)
                 new_inst_size = len(encoding)
                 
-                Log.debug("Labeling: "+hex(ip)+" "+str(new_assembly)+" ("+hex(new_inst_size)+") "+str([hex(x) for x in encoding]))
+                Log.debug("Labeling: %#x %s (%#x) %s", ip, new_assembly, new_inst_size, encoding)
 
                 
                 ip_disp = inst_pc_disp(inst)
@@ -330,6 +380,39 @@ class ExpandLocalBufferPatch:
         self.symbolized_assembly = out_assembly
         return labels_to_new_addr
 
+    # Replace absolute addresses of relocated static data (see ExpandBufferManager.add_data_mapping)
+    def map_data(self, assembly):
+        for old_addr, new_addr in self.data_mapping.items():
+            old_addr = int(old_addr)
+            new_addr = int(new_addr)
+            if hex(old_addr) in assembly:
+                old_assembly = assembly
+                assembly = replace_disp(assembly, old_addr, new_addr, False)
+                Log.debug('Data access changes: ' + assembly + '--------->' + old_assembly)
+        return assembly
+
+    # Re-encode only the modified instructions at their original addresses.
+    # A shorter encoding is padded with NOPs, so the rest of the function does not move.
+    # Return {inst addr: bytes}, or None if any instruction no longer fits (function has to be relocated)
+    def rewrite_in_place(self):
+        out = {}
+        for inst in self.elb.assembly:
+            old_assembly = construct_asm(inst)
+            new_assembly = self.elb.mod_assembly.get(inst.address, old_assembly)
+            new_assembly = self.map_data(new_assembly)
+            if new_assembly == old_assembly:
+                continue
+
+            encoding = self.asm_single_inst(new_assembly, addr=inst.address)
+            if len(encoding) > inst.size:
+                Log.info('In-place rewrite does not fit at ' + hex(inst.address) + ': ' + new_assembly + ' (' + str(len(encoding)) + ' vs ' + str(inst.size) + ' bytes)')
+                return None
+
+            encoding = bytearray(encoding) + bytearray([NOP_OPCODE]*(inst.size-len(encoding)))
+            Log.debug('In-place: ' + hex(inst.address) + ': ' + old_assembly + '------>' + new_assembly)
+            out[inst.address] = str(encoding)
+        return out
+
     # Rewrite the function w.r.t new_vaddr address
     def rewrite(self, new_vaddr):
         labels_to_new_addr = self.rewrite_based_on_labels(new_vaddr)
@@ -364,7 +447,7 @@ class ExpandLocalBufferPatch:
 
             try:
                 old_addr = d['old_addr']
-                Log.debug("assing: "+str(ass))
+                Log.debug("assing: %s", ass)
                 new_encoding = self.asm_single_inst(ass, addr=a)
                 #Log.debug("Whyyy?: "+hex(a)+' '+str(ass)+" "+str([hex(x) for x in encoding])+"("+hex(len(encoding))+")")
                 #Log.debug("assing: "+str(old_ass))
@@ -415,10 +498,20 @@ class ExpandBufferManager:
         Log.info('ELB Manager: generating ' + str(len(self.elbs)) + ' patch(es)')
         patches = []
         for _, elb in self.elbs.items():
-            elb.expand()
+            with TRACER.span('elb expand', 'rewriter', fn=hex(elb.start_vaddr)):
+                elb.expand()
             patches.append(ExpandLocalBufferPatch(elb, data_mapping=self.data_mapping))
         return patches
 
+    # Per-function disassemblies are only needed until the patches are applied
+    def release(self):
+        for elb in self.elbs.values():
+            elb.assembly = None
+        self.esbs = {}
+
+    def footprints(self):
+        return {'elb assembly': [elb.assembly for elb in self.elbs.values()]}
+
     def expand_static_mem(self, binary, addr, old_size, new_size):
         if addr in self.esbs:
             if self.esbs[addr].buffer_old_size != old_size:
@@ -746,9 +839,7 @@ class ExpandLocalBuffer:
         return self.mod_assembly
 
     def disassemble(self):
-        content = self.binary.angr_proj.loader.memory.read_bytes(self.start_vaddr, self.end_vaddr - self.start_vaddr)
-        self.binary.angr_proj.arch.capstone.syntax = CS_OPT_SYNTAX_ATT
-        return list(self.binary.angr_proj.arch.capstone.disasm(bytearray(content), self.start_vaddr))
+        return self.binary.disasm(self.start_vaddr, self.end_vaddr)
 
     def get_initial_stack_size(self):
         # Prologue always consists of sub(or add) rsp, $const (if the function uses stack)
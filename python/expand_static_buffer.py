@@ -23,6 +23,10 @@ class ExpandStaticBuffer:
         self.buffer_old_size = buffer_old_size
         self.buffer_new_size = buffer_new_size
         self.caller_inst_addrs = self.binary.ca.data_refs(buffer_addr, buffer_addr+buffer_old_size)
+        # Demand-driven CFG (RegionCallerAnalysis): recover the functions referencing the buffer first
+        if hasattr(binary.ca, 'recover_function'):
+            for addr in self.caller_inst_addrs:
+                binary.ca.recover_function(binary.ca.get_func_scope(addr)[0])
 
     # Return all functions and corresponding instruction using this statically allocated buffer
     def functions_use_buffer(self):
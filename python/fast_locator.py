@@ -7,7 +7,6 @@ from alice_logger import AliceLog
 import logging
 
 Log = AliceLog['locator']
-Log.setLevel(logging.DEBUG)
 
 # ----------------- Class implementation -----------------------
 
@@ -17,7 +16,7 @@ class FastLocator(AbstractLocator):
     def get_address_locations(self, crypto_desc):
         addrs = []
         bbs, rodata_contain_ind = self._locate(crypto_desc)
-        Log.debug("BBS: "+str(bbs)+' '+str(rodata_contain_ind))
+        Log.debug("BBS: %s %s", bbs, rodata_contain_ind)
         # TODO: quickfix
         #if not self.contain(crypto_desc, bbs, rodata_contain_ind):
         if not rodata_contain_ind and not bbs:
@@ -32,10 +31,10 @@ class FastLocator(AbstractLocator):
         if rodata_contain_ind is not None and rodata_contain_ind:
             for rodata_const in crypto_desc.rodata_contain:
                 for data_absolute_addr in rodata_contain_ind[rodata_const]:
-                    Log.debug("Searching ref data: "+hex(data_absolute_addr)+' : '+hex(data_absolute_addr+idx_to_bytes(len(rodata_const), self.binary.format)))
+                    Log.debug("Searching ref data: %#x : %#x", data_absolute_addr, data_absolute_addr+idx_to_bytes(len(rodata_const), self.binary.format))
                     data_ref_addrs = self.binary.ca.data_refs(data_absolute_addr, data_absolute_addr+idx_to_bytes(len(rodata_const), self.binary.format))
                     addrs += data_ref_addrs
-        Log.debug("Find: "+str(rodata_contain_ind)+" addr refing it: "+str(addrs))
+        Log.debug("Find: %s addr refing it: %s", rodata_contain_ind, addrs)
         return list(set(addrs))
 
     def contain(self, crypto_desc, bbs=None, rodata_contain_ind=None):
@@ -54,7 +53,7 @@ class FastLocator(AbstractLocator):
         # Compute absolute addrs
         rodata_section = self.binary.get_section(self.binary.get_rodata_section_name())
         rodata_contain_ind = self._locate_in_section(self.binary.get_rodata_section_name(), crypto_desc.get_rodata_contain(self.binary.format))
-        Log.debug("Find rodata at: "+str(rodata_contain_ind))
+        Log.debug("Find rodata at: %s", rodata_contain_ind)
         for k in rodata_contain_ind:
             vals = [(idx_to_bytes(x, self.binary.format)+rodata_section.start_vaddr) for x in rodata_contain_ind[k]]
             rodata_contain_ind[k] = vals
@@ -79,13 +78,22 @@ class FastLocator(AbstractLocator):
         if len(answers.keys()) != len(whitelist):
             return list(out_blocks)
 
+        # Each block of the map is checked once, however many hits it holds
+        checked = set()
         for const in answers.keys():
             for idx in answers[const]:
                 vaddr = section.start_vaddr + idx_to_bytes(idx, self.binary.format)
 
                 if not section.contain_addr(vaddr):
                     continue
-                block = self.binary.get_accurate_bb(vaddr)
+                block = self.binary.get_mapped_bb(vaddr)
+                if block is None:
+                    # Not reached by the linear sweep
+                    block = self.binary.get_accurate_bb(vaddr)
+                elif block.start_vaddr in checked:
+                    continue
+                else:
+                    checked.add(block.start_vaddr)
 
                 wl_ans, bl_ans = advanced_search(block.get_val(self.binary.format), whitelist, blacklist)
 
@@ -99,7 +107,7 @@ class FastLocator(AbstractLocator):
     # In each dict, you can query, e.g., dict1[e] returns all virtual addresses containing element e (from WL)
     def _locate_in_section(self, section_name, const_list):
         section = self.binary.get_section(section_name)
-        Log.debug("Searching section: "+section_name+" const: "+str(const_list))
+        Log.debug("Searching section: %s const: %s", section_name, const_list)
         return search(section.get_val(self.binary.format), const_list)
 
 
@@ -4,7 +4,6 @@ from alice_logger import AliceLog
 import logging
 
 Log = AliceLog['locator']
-Log.setLevel(logging.DEBUG)
 
 
 class FastScoper(AbstractScoper):
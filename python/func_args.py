@@ -13,4 +13,13 @@ class AliceArg:
         self.output = None
 
     def copy(self):
-        return AliceArg(self.type, self.val, self.ref_val, self.expected_output)
\ No newline at end of file
+        return AliceArg(self.type, self.val, self.ref_val, self.expected_output)
+
+# Signature name from the result of CryptoAsserter.probe_outputs, False if ``expected_output" is in neither buffer
+def probe_match(probe_result, expected_output):
+    buf_output, inlen_output, rdx_read = probe_result
+    if buf_output[:len(expected_output)] == expected_output:
+        return 'out_in_inlen' if rdx_read else 'out_in'
+    if inlen_output[:len(expected_output)] == expected_output:
+        return 'in_inlen_out'
+    return False
@@ -0,0 +1,95 @@
+import os
+import gc
+import sys
+import tempfile
+import numpy as np
+from alice_logger import AliceLog
+
+Log = AliceLog['main']
+
+# Arrays smaller than this stay in memory even when spilling is on
+SPILL_MIN_BYTES = 1 << 20
+
+def rss_bytes():
+    try:
+        with open('/proc/self/statm') as f:
+            return int(f.read().split()[1]) * os.sysconf('SC_PAGE_SIZE')
+    except (IOError, ValueError):
+        return 0
+
+# Rough resident size of the structures ALICE keeps (not a deep sizeof: list items are sampled)
+def footprint(obj):
+    if obj is None:
+        return 0
+    if isinstance(obj, np.memmap):
+        return 0
+    if isinstance(obj, np.ndarray):
+        return obj.nbytes
+    if isinstance(obj, str):
+        return len(obj)
+    if isinstance(obj, (list, tuple, set)):
+        n = len(obj)
+        if n == 0:
+            return sys.getsizeof(obj)
+        if n <= 64:
+            return sys.getsizeof(obj) + sum([footprint(x) for x in obj])
+        sample = list(obj)[:64] if not isinstance(obj, list) else obj[:64]
+        return sys.getsizeof(obj) + n * sum([sys.getsizeof(x) for x in sample]) / len(sample)
+    if isinstance(obj, dict):
+        return sys.getsizeof(obj) + sum([footprint(v) for v in obj.values()])
+    if hasattr(obj, 'bytes'):
+        return footprint(obj.bytes)
+    return sys.getsizeof(obj)
+
+
+# Memory budget of one ALICE process, set with ALICE_MEM_BUDGET_MB (unset: no budget)
+# When a budget is set, large read-mostly tables (instruction index, call-site index, CFG edges) are
+# spilled to memory-mapped files under ALICE_SPILL_DIR, and transient structures are dropped between phases
+class MemoryBudget:
+
+    def __init__(self, limit_mb=None, spill_dir=None):
+        self.limit = limit_mb * (1 << 20) if limit_mb else None
+        self.spill_dir = spill_dir
+        self.spilled = {}
+
+    @property
+    def enabled(self):
+        return self.limit is not None
+
+    def _spill_dir(self):
+        if self.spill_dir is None:
+            self.spill_dir = tempfile.mkdtemp(prefix='alice-spill-')
+        elif not os.path.exists(self.spill_dir):
+            os.makedirs(self.spill_dir)
+        return self.spill_dir
+
+    # Return ``arr" or, under a budget, a read-only memory-mapped copy of it
+    def spill(self, name, arr):
+        arr = np.asarray(arr)
+        if not self.enabled or arr.nbytes < SPILL_MIN_BYTES:
+            return arr
+        path = os.path.join(self._spill_dir(), '%s-%d.npy' % (name, os.getpid()))
+        np.save(path, arr)
+        self.spilled[name] = path
+        Log.debug('Spilled %s (%d kB) to %s', name, arr.nbytes >> 10, path)
+        return np.load(path, mmap_mode='r')
+
+    # Log per-structure footprints ({name: object}) and the process RSS; warn if over budget
+    def report(self, phase, structures):
+        gc.collect()
+        rss = rss_bytes()
+        for name in sorted(structures.keys()):
+            Log.info('[mem] %-10s %-24s %8d kB', phase, name, footprint(structures[name]) >> 10)
+        Log.info('[mem] %-10s %-24s %8d kB', phase, 'rss', rss >> 10)
+        if self.enabled and rss > self.limit:
+            Log.warning('[mem] ' + phase + ': rss ' + str(rss >> 20) + ' MB over budget of ' + str(self.limit >> 20) + ' MB')
+
+    def cleanup(self):
+        for path in self.spilled.values():
+            if os.path.exists(path):
+                os.remove(path)
+        self.spilled = {}
+
+
+BUDGET = MemoryBudget(int(os.environ['ALICE_MEM_BUDGET_MB']) if os.environ.get('ALICE_MEM_BUDGET_MB') else None,
+                      os.environ.get('ALICE_SPILL_DIR'))
@@ -0,0 +1,356 @@
+import os
+import signal
+import ctypes
+import struct
+import threading
+from func_args import *
+from execution_budget import ExecutionAborted, ExecutionTimedOut, DEFAULT_BUDGET
+from elf_loader import ElfFile
+from alice_trace import TRACER
+
+# Native replacement for CryptoAsserter on non-PIE x86-64 Linux binaries
+# The target is started under ptrace and stopped at main, after __libc_start_main has set up TLS, the stack guard
+# (%fs:0x28), malloc and constructors, so candidates run in the state they are called in by the program.
+# That process is only a template: for every candidate call a fork syscall is injected into it, and the
+# ptrace-attached child gets the arguments, calls the candidate natively and is killed afterwards.
+# Crashes, loops and stray syscalls of a candidate only affect its child. Pointer arguments (0x200, 0x2000, ...)
+# are below mmap_min_addr, so they are mapped at BUF_BASE + address instead
+
+libc = ctypes.CDLL(None, use_errno=True)
+libc.ptrace.restype = ctypes.c_long
+libc.ptrace.argtypes = [ctypes.c_long, ctypes.c_long, ctypes.c_void_p, ctypes.c_void_p]
+
+PTRACE_TRACEME = 0
+PTRACE_CONT = 7
+PTRACE_SINGLESTEP = 9
+PTRACE_GETREGS = 12
+PTRACE_SETREGS = 13
+PTRACE_SYSCALL = 24
+PTRACE_SETOPTIONS = 0x4200
+PTRACE_GETEVENTMSG = 0x4201
+PTRACE_O_TRACESYSGOOD = 0x1
+PTRACE_O_TRACEFORK = 0x2
+PTRACE_O_EXITKILL = 0x100000
+PTRACE_EVENT_FORK = 1
+WALL = 0x40000000
+
+SYS_MMAP = 9
+SYS_FORK = 57
+# Syscalls a hash function may reach (through malloc/free; glibc seeds the tcache key with getrandom on first use)
+ALLOWED_SYSCALLS = set([9, 10, 11, 12, 25, 318])    # mmap, mprotect, munmap, brk, mremap, getrandom
+
+ET_EXEC = 2
+BUF_BASE = 0x100000000000
+BUF_SIZE = 0x10000
+# int3 page used as the return address of every call
+SENTINEL = BUF_BASE + BUF_SIZE
+CALL_TIMEOUT = 2.0
+# _start is stepped until it calls __libc_start_main, which takes main in rdi
+START_SIZE = 0x40
+START_STEPS = 64
+
+class NativeUnavailable(Exception):
+    pass
+
+
+class UserRegs(ctypes.Structure):
+    _fields_ = [(name, ctypes.c_ulonglong) for name in
+                ('r15', 'r14', 'r13', 'r12', 'rbp', 'rbx', 'r11', 'r10', 'r9', 'r8', 'rax', 'rcx', 'rdx', 'rsi', 'rdi',
+                 'orig_rax', 'rip', 'cs', 'eflags', 'rsp', 'ss', 'fs_base', 'gs_base', 'ds', 'es', 'fs', 'gs')]
+
+    def copy(self):
+        regs = UserRegs()
+        ctypes.pointer(regs)[0] = self
+        return regs
+
+
+def _ptrace(request, pid, addr=0, data=0):
+    res = libc.ptrace(request, pid, addr, data)
+    if res == -1:
+        e = ctypes.get_errno()
+        raise OSError(e, 'ptrace(%d, %d): %s' % (request, pid, os.strerror(e)))
+    return res
+
+def _wait(pid):
+    _, status = os.waitpid(pid, WALL)
+    return status
+
+def _get_regs(pid):
+    regs = UserRegs()
+    _ptrace(PTRACE_GETREGS, pid, 0, ctypes.addressof(regs))
+    return regs
+
+def _set_regs(pid, regs):
+    _ptrace(PTRACE_SETREGS, pid, 0, ctypes.addressof(regs))
+
+def _read_mem(pid, addr, size):
+    with open('/proc/%d/mem' % pid, 'rb', 0) as f:
+        f.seek(addr)
+        return f.read(size)
+
+def _write_mem(pid, addr, data):
+    with open('/proc/%d/mem' % pid, 'r+b', 0) as f:
+        f.seek(addr)
+        f.write(data)
+
+def _kill(pid):
+    try:
+        os.kill(pid, signal.SIGKILL)
+        _wait(pid)
+    except OSError:
+        pass
+
+
+class NativeAsserter:
+    BACKEND = 'native'
+    IN_ADDR = 0x2000
+    OUT_ADDR = 0x3000
+    IN_LEN = 9
+    TEST_STRING = "oakoakoak"+'\0'
+
+    def __init__(self, path, budget=DEFAULT_BUDGET, timeout=CALL_TIMEOUT):
+        self.path = path
+        self.budget = budget
+        self.timeout = timeout
+        self.template = None
+        elf = ElfFile(path)
+        try:
+            if elf.e_type != ET_EXEC:
+                raise NativeUnavailable(path + ' is position-independent')
+            self.entry = elf.entry
+        finally:
+            elf.close()
+
+    # Continue the stopped process to addr (int3 there), return its registers with rip back at addr, or None if it
+    # stopped elsewhere
+    def _run_to(self, pid, addr):
+        orig = _read_mem(pid, addr, 1)
+        _write_mem(pid, addr, '\xcc')
+        _ptrace(PTRACE_CONT, pid)
+        status = _wait(pid)
+        if not os.WIFSTOPPED(status):
+            return None
+        regs = _get_regs(pid)
+        _write_mem(pid, addr, orig)
+        if regs.rip != addr + 1:
+            return None
+        regs.rip = addr
+        _set_regs(pid, regs)
+        return regs
+
+    # Address of main, from the process stopped at the entry point: single-step _start until it calls
+    # __libc_start_main(main, argc, argv, ...). Works on stripped binaries, unlike a symbol lookup
+    def _find_main(self, pid):
+        for _ in range(START_STEPS):
+            _ptrace(PTRACE_SINGLESTEP, pid)
+            if not os.WIFSTOPPED(_wait(pid)):
+                break
+            regs = _get_regs(pid)
+            if not self.entry <= regs.rip < self.entry + START_SIZE:
+                ret = struct.unpack('<Q', _read_mem(pid, regs.rsp, 8))[0]
+                if self.entry <= ret <= self.entry + START_SIZE:
+                    return regs.rdi
+                break
+        return None
+
+    # Start the template process, stopped at main with the buffers mapped
+    def start(self):
+        pid = os.fork()
+        if pid == 0:
+            try:
+                devnull = os.open(os.devnull, os.O_RDWR)
+                for fd in (0, 1, 2):
+                    os.dup2(devnull, fd)
+                _ptrace(PTRACE_TRACEME, 0)
+                os.execv(self.path, [self.path])
+            finally:
+                os._exit(127)
+
+        status = _wait(pid)
+        if not os.WIFSTOPPED(status):
+            raise NativeUnavailable('cannot start ' + self.path)
+        _ptrace(PTRACE_SETOPTIONS, pid, 0, PTRACE_O_EXITKILL | PTRACE_O_TRACEFORK | PTRACE_O_TRACESYSGOOD)
+
+        # Run to the entry point, then to main
+        regs = self._run_to(pid, self.entry)
+        main = self._find_main(pid) if regs is not None else None
+        regs = self._run_to(pid, main) if main else None
+        if regs is None:
+            _kill(pid)
+            raise NativeUnavailable('did not reach main in ' + self.path)
+        self.template = pid
+        self.template_regs = regs
+
+        # Buffers and the int3 page, fresh (zero-filled) in every child
+        base, _ = self._syscall(pid, SYS_MMAP, BUF_BASE, BUF_SIZE + 0x1000, 0x7, 0x32, -1, 0)   # RWX, PRIVATE|ANON|FIXED
+        if base != BUF_BASE:
+            self.close()
+            raise NativeUnavailable('cannot map buffers at %#x' % BUF_BASE)
+        _write_mem(pid, SENTINEL, '\xcc' * 0x1000)
+
+    # Execute one syscall in the stopped process ``pid", return (rax, pid of a forked child)
+    def _syscall(self, pid, nr, *args):
+        saved = _get_regs(pid)
+        code = _read_mem(pid, saved.rip, 2)
+        _write_mem(pid, saved.rip, '\x0f\x05')
+        regs = saved.copy()
+        regs.rax = nr
+        for name, val in zip(('rdi', 'rsi', 'rdx', 'r10', 'r8', 'r9'), args):
+            setattr(regs, name, val & 0xffffffffffffffff)
+        _set_regs(pid, regs)
+
+        child = None
+        while True:
+            _ptrace(PTRACE_SINGLESTEP, pid)
+            status = _wait(pid)
+            if not os.WIFSTOPPED(status):
+                raise NativeUnavailable('template process died')
+            if status >> 8 == (signal.SIGTRAP | (PTRACE_EVENT_FORK << 8)):
+                msg = ctypes.c_ulong()
+                _ptrace(PTRACE_GETEVENTMSG, pid, 0, ctypes.addressof(msg))
+                child = msg.value
+                continue
+            if os.WSTOPSIG(status) == signal.SIGTRAP:
+                break
+        rax = _get_regs(pid).rax
+        _write_mem(pid, saved.rip, code)
+        _set_regs(pid, saved)
+        if child is not None:
+            # The child was forked while the syscall bytes were in place
+            _wait(child)
+            _write_mem(child, saved.rip, code)
+        return ctypes.c_longlong(rax).value, child
+
+    def _fork(self):
+        if self.template is None:
+            self.start()
+        _, child = self._syscall(self.template, SYS_FORK)
+        if child is None:
+            raise NativeUnavailable('fork failed in the template process')
+        return child
+
+    # Call fn_addr(*args) in a fresh child. ``buffers": [(address, bytes)] written before the call.
+    # Return the child, stopped after the return; the caller reads its memory and kills it
+    def _call(self, fn_addr, args, buffers):
+        TRACER.count('native_calls')
+        child = self._fork()
+        try:
+            for addr, data in buffers:
+                _write_mem(child, BUF_BASE + addr, data)
+            regs = self.template_regs.copy()
+            regs.rsp = ((regs.rsp - 0x1000) & ~0xf) - 8
+            _write_mem(child, regs.rsp, struct.pack('<Q', SENTINEL))
+            regs.rip = fn_addr
+            regs.rax = 0
+            for name, val in zip(('rdi', 'rsi', 'rdx', 'rcx', 'r8', 'r9'), args):
+                setattr(regs, name, val)
+            _set_regs(child, regs)
+            self._run(child)
+        except:
+            _kill(child)
+            raise
+        return child
+
+    # Run until the candidate returns to SENTINEL. Syscalls other than memory management, signals, and running
+    # longer than self.timeout abort the call
+    def _run(self, pid):
+        timer = threading.Timer(self.timeout, os.kill, (pid, signal.SIGKILL))
+        timer.start()
+        try:
+            while True:
+                _ptrace(PTRACE_SYSCALL, pid)
+                status = _wait(pid)
+                if os.WIFSIGNALED(status) and os.WTERMSIG(status) == signal.SIGKILL and not timer.is_alive():
+                    raise ExecutionTimedOut('more than %.1fs' % self.timeout)
+                if not os.WIFSTOPPED(status):
+                    raise ExecutionAborted('exited with status %#x' % status)
+                sig = os.WSTOPSIG(status)
+                if sig == signal.SIGTRAP | 0x80:
+                    nr = _get_regs(pid).orig_rax
+                    if nr not in ALLOWED_SYSCALLS:
+                        raise ExecutionAborted('syscall %d' % nr)
+                    continue
+                if sig == signal.SIGTRAP and _get_regs(pid).rip == SENTINEL + 1:
+                    return
+                raise ExecutionAborted('signal %d at %#x' % (sig, _get_regs(pid).rip))
+        finally:
+            timer.cancel()
+
+    def _run_argv(self, fn_addr, argv, out_bytelen):
+        args = [BUF_BASE + x.val if x.type == AliceArg.TYPE_BYTE_POINTER else x.val for x in argv]
+        buffers = [(x.val, x.ref_val) for x in argv if x.type == AliceArg.TYPE_BYTE_POINTER]
+        child = self._call(fn_addr, args, buffers)
+        try:
+            for arg in argv:
+                if arg.expected_output is not None:
+                    arg.output = _read_mem(child, BUF_BASE + arg.val, out_bytelen)
+        finally:
+            _kill(child)
+        return argv
+
+    # Same interface as CryptoAsserter
+    def assert_fn(self, fn_addr, out_bytelen, argv):
+        argv_out = self.execute_fn(fn_addr, out_bytelen, argv)
+        for arg in argv_out:
+            if arg.expected_output is not None and arg.output[:out_bytelen] != arg.expected_output[:out_bytelen]:
+                print 'Fn addr: ', hex(fn_addr), 'Expected Output: ', arg.expected_output[:out_bytelen].encode("hex"), ' output: ', arg.output[:out_bytelen].encode("hex")
+                return False
+        return True
+
+    def execute_fn(self, fn_addr, out_bytelen, argv):
+        return self._run_argv(fn_addr, argv, out_bytelen)
+
+    # probe_signature places the input at address in_len, which cannot be mapped natively:
+    # search_real_entry then runs each signature, which is cheap here
+    def probe_signature(self, fn_addr, out_bytelen, in_bytes, in_len, expected_output, buf_addr=0x200):
+        return None
+
+    def probe_outputs(self, fn_addr, out_bytelen, in_bytes, in_len, buf_addr=0x200):
+        return None
+
+    def assert_fn_output(self, fn_addr, out_hexstr, in_str=None, in_len=None, out_byte_len=None):
+        output = self.get_fn_output(fn_addr, in_str, in_len, out_byte_len)
+        if output is None:
+            return False
+        return output.upper() == out_hexstr.upper()
+
+    def get_fn_output(self, fn_addr, in_str=None, in_len=None, out_len=None):
+        if in_str is None:
+            in_str = self.TEST_STRING
+        if in_len is None:
+            in_len = self.IN_LEN
+        if out_len is None:
+            out_len = 64
+        buffers = [(self.IN_ADDR, in_str[:in_len].ljust(out_len, 'a')), (self.OUT_ADDR, in_str[:in_len].ljust(out_len, 'a'))]
+        try:
+            child = self._call(fn_addr, [BUF_BASE + self.IN_ADDR, in_len, BUF_BASE + self.OUT_ADDR], buffers)
+            try:
+                output = _read_mem(child, BUF_BASE + self.OUT_ADDR, out_len).encode('hex')
+            finally:
+                _kill(child)
+        except Exception as e:
+            output = None
+            print 'Fn addr: ' + hex(fn_addr) + ' Asserter Exception: ' + str(e)
+        return output
+
+    def close(self):
+        if self.template is not None:
+            _kill(self.template)
+            self.template = None
+
+
+if __name__ == '__main__':
+    import sys
+    from desc import MD5Desc
+    from patch import generate_all_possible_args
+    # Usage: python native_asserter.py binary fn_addr [fn_addr ...]
+    asserter = NativeAsserter(sys.argv[1])
+    sample = MD5Desc.sample_ios[0]
+    all_argvs = generate_all_possible_args(sample['input'], sample['input-len'], sample['output'].decode('hex'))
+    for fn_addr in [int(x, 16) for x in sys.argv[2:]]:
+        for name, argv in all_argvs.items():
+            try:
+                print hex(fn_addr), name, asserter.assert_fn(fn_addr, len(sample['output'])/2, argv)
+            except ExecutionAborted as e:
+                print hex(fn_addr), name, 'aborted:', e
+    asserter.close()
@@ -0,0 +1,185 @@
+#!/usr/bin/env python2
+# Run ALICE on many binaries with the three phases pipelined: binary N+1 is detected while
+# N is being scoped (Pin/Triton) and N-1 is being rewritten.
+# Each stage has its own concurrency limit and a bounded input queue, so a slow stage
+# holds back the ones before it instead of piling up finished work in memory.
+#
+# Usage: python pipeline.py [--out-dir ./out] [--cfg region|full] [--detect-workers N] [--scope-workers N]
+#                           [--rewrite-workers N] [--queue-size N] config [config ...]
+#   config: name of a module in ./configs, e.g. md5sum_O2
+import os
+import sys
+import time
+import Queue
+import argparse
+import threading
+import traceback
+import multiprocessing
+from alice import AliceJob, detect_stage, scope_stage, rewrite_stage, rewrite_up_to_date
+from alice_trace import TRACER
+from alice_logger import AliceLog
+
+Log = AliceLog['main']
+
+
+# One binary going through the pipeline
+class PipelineItem:
+
+    def __init__(self, config_name, job):
+        self.config_name = config_name
+        self.job = job
+        self.patched_entries = None
+        self.taint_mems = None
+        self.out_name = None
+        self.status = None      # set once the item leaves the pipeline
+        self.times = {}
+
+    def finish(self, status):
+        self.status = status
+
+
+# Runs in a pool process (detect, rewrite) or in a stage thread (scope)
+# Each stage records its own spans and counters: scope stages of different binaries run in threads of one process
+def run_stage(stage, item, out_dir, cfg_mode):
+    with TRACER.recording():
+        return _run_stage(stage, item, out_dir, cfg_mode)
+
+def _run_stage(stage, item, out_dir, cfg_mode):
+    start = time.time()
+    try:
+        if stage == 'detect':
+            if rewrite_up_to_date(item.job, out_dir):
+                item.out_name = item.job.out_name(out_dir)
+                item.finish('up to date')
+            else:
+                item.patched_entries = detect_stage(item.job, out_dir, cfg_mode)
+                if not item.patched_entries:
+                    item.finish('no crypto entry found')
+        elif stage == 'scope':
+            item.taint_mems = scope_stage(item.job, out_dir, item.patched_entries)
+            if item.taint_mems is None:
+                item.finish('scoping produced no output')
+        elif stage == 'rewrite':
+            item.out_name = rewrite_stage(item.job, out_dir, item.patched_entries, item.taint_mems, cfg_mode)
+            item.finish('patched')
+    except Exception:
+        Log.error(item.config_name + ': ' + stage + ' failed\n' + traceback.format_exc())
+        item.finish(stage + ' failed')
+    finally:
+        item.times[stage] = time.time() - start
+        TRACER.dump_chrome(os.path.join(out_dir, 'trace', item.job.filename + '.' + stage + '.json'))
+    return item
+
+
+class Stage:
+
+    def __init__(self, name, workers, queue_size, use_processes):
+        self.name = name
+        self.workers = workers
+        self.inbox = Queue.Queue(maxsize=queue_size)
+        # Processes for the CPU-bound Python stages (GIL), threads for the scoping stage which waits on Pin
+        self.pool = multiprocessing.Pool(workers) if use_processes else None
+        self.threads = []
+        self.busy = 0.0
+
+    def execute(self, item, out_dir, cfg_mode):
+        if self.pool is not None:
+            return self.pool.apply(run_stage, (self.name, item, out_dir, cfg_mode))
+        return run_stage(self.name, item, out_dir, cfg_mode)
+
+    def close(self):
+        if self.pool is not None:
+            self.pool.close()
+            self.pool.join()
+
+
+class Pipeline:
+
+    def __init__(self, out_dir, cfg_mode='region', detect_workers=1, scope_workers=1, rewrite_workers=1, queue_size=2):
+        self.out_dir = out_dir
+        self.cfg_mode = cfg_mode
+        # Pools are forked here, before any thread is started
+        self.stages = [Stage('detect', detect_workers, queue_size, True),
+                       Stage('scope', scope_workers, queue_size, False),
+                       Stage('rewrite', rewrite_workers, queue_size, True)]
+        self.lock = threading.Lock()
+        self.results = []
+
+    def _worker(self, i):
+        stage = self.stages[i]
+        nxt = self.stages[i+1] if i+1 < len(self.stages) else None
+        while True:
+            item = stage.inbox.get()
+            if item is None:
+                break
+            start = time.time()
+            item = stage.execute(item, self.out_dir, self.cfg_mode)
+            with self.lock:
+                stage.busy += time.time() - start
+            if item.status is not None or nxt is None:
+                Log.warning(item.config_name + ': ' + str(item.status))
+                with self.lock:
+                    self.results.append(item)
+            else:
+                # Blocks while the next stage is full (backpressure)
+                nxt.inbox.put(item)
+
+    def run(self, config_names):
+        start = time.time()
+        for i, stage in enumerate(self.stages):
+            for _ in xrange(stage.workers):
+                t = threading.Thread(target=self._worker, args=(i,))
+                t.daemon = True
+                t.start()
+                stage.threads.append(t)
+
+        for name in config_names:
+            try:
+                job = AliceJob.from_config(name)
+            except Exception as e:
+                Log.error(name + ': cannot load config: ' + str(e))
+                continue
+            self.stages[0].inbox.put(PipelineItem(name, job))
+
+        # Drain stage by stage: once all workers of a stage are done, nothing more can reach the next one
+        for stage in self.stages:
+            for _ in xrange(stage.workers):
+                stage.inbox.put(None)
+            for t in stage.threads:
+                t.join()
+            stage.close()
+
+        self.wall = time.time() - start
+        return self.results
+
+    def print_summary(self):
+        for item in sorted(self.results, key=lambda x: x.config_name):
+            times = ' '.join(['%s %.1fs' % (s.name, item.times[s.name]) for s in self.stages if s.name in item.times])
+            print '%-24s %-28s %s' % (item.config_name, item.status, times)
+        for stage in self.stages:
+            print 'Stage %-8s workers %d busy %.1fs' % (stage.name, stage.workers, stage.busy)
+        print 'Wall: %.1fs (sum of stages: %.1fs)' % (self.wall, sum([s.busy for s in self.stages]))
+
+
+def main():
+    cpus = multiprocessing.cpu_count()
+    parser = argparse.ArgumentParser(description='Pipelined ALICE over many binaries')
+    parser.add_argument('configs', nargs='+', help='config module names in ./configs')
+    parser.add_argument('--out-dir', default='./out')
+    parser.add_argument('--cfg', default='region', choices=['region', 'full'])
+    parser.add_argument('--detect-workers', type=int, default=max(1, cpus/2), help='angr, CPU-bound')
+    parser.add_argument('--scope-workers', type=int, default=1, help='Pin/Triton, memory-bound')
+    parser.add_argument('--rewrite-workers', type=int, default=2)
+    parser.add_argument('--queue-size', type=int, default=2, help='max items waiting in front of each stage')
+    args = parser.parse_args()
+
+    if not os.path.exists(args.out_dir):
+        os.makedirs(args.out_dir)
+    pipeline = Pipeline(args.out_dir, args.cfg, args.detect_workers, args.scope_workers, args.rewrite_workers, args.queue_size)
+    results = pipeline.run(args.configs)
+    pipeline.print_summary()
+    return 0 if all([item.status in ('patched', 'up to date') for item in results]) else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
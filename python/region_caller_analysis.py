@@ -0,0 +1,169 @@
+from angr_caller_analysis import *
+from memory_budget import BUDGET
+from alice_logger import AliceLog
+import numpy as np
+from bisect import bisect_right
+
+Log = AliceLog['locator']
+
+CALL_OPCODE = 0xe8
+# x86 linear decoding falls back into step with the real instruction stream within a few instructions
+RESYNC_BYTES = 64
+MAX_INST_SIZE = 15
+
+
+# Functions recovered so far, in the shape ExpandStaticBuffer expects from a CFGFast result
+class RegionCFG:
+
+    def __init__(self, binary):
+        self.binary = binary
+
+    @property
+    def functions(self):
+        return self.binary.angr_proj.kb.functions
+
+
+# Demand-driven replacement for AngrCallerAnalysis
+# Instead of a whole-program CFGFast, function starts come from an index of the e8 rel32 call sites in .text
+# (plus ELF function symbols), and CFGFast only runs on the functions that are actually queried:
+# the ones containing constant hits and, through code_refs, their callers up to the scoper's height
+# Candidate starts are validated lazily and locally (see valid_start), with a result that only depends on the bytes
+# around them, so scopes do not depend on the order of queries. They can still
+# merge a function only reached through a jmp or a function pointer into its predecessor: the rewriting phase takes
+# its scopes from the whole-program CFG instead (see rewrite_stage)
+class RegionCallerAnalysis(AngrCallerAnalysis):
+
+    def __init__(self, binary, deepcopy=False):
+        self.disassembly = None
+        self.insts = None
+        AbstractCallerAnalysis.__init__(self, binary, deepcopy)
+        self.simple_ca = None
+        self.cfg = RegionCFG(self.binary)
+        self.recovered = {}
+        self.valid_starts = {}
+        self.build_call_index()
+
+    # Byte scan of .text for e8 rel32. Sites are not validated here (e8 can be part of another instruction),
+    # function starts are when a scope needs them (valid_start) and code_refs checks sites against the recovered caller
+    def build_call_index(self):
+        text_section = self.binary.get_section(self.binary.get_text_section_name())
+        data = np.frombuffer(text_section.get_bytearray(), dtype=np.uint8)
+        idx = np.nonzero(data[:-4] == CALL_OPCODE)[0]
+        rel = (data[idx+1].astype(np.uint32) | (data[idx+2].astype(np.uint32) << 8) |
+               (data[idx+3].astype(np.uint32) << 16) | (data[idx+4].astype(np.uint32) << 24)).view(np.int32)
+        sites = idx.astype(np.int64) + text_section.start_vaddr
+        targets = sites + 5 + rel.astype(np.int64)
+        mask = (targets >= text_section.start_vaddr) & (targets < text_section.end_vaddr)
+        sites, targets = sites[mask], targets[mask]
+
+        order = np.argsort(targets, kind='mergesort')
+        self.call_sites = BUDGET.spill('call_sites', sites[order])
+        self.call_targets = BUDGET.spill('call_targets', targets[order])
+
+        self.symbol_starts = sorted(set([sym.vaddr for sym in self.binary.elf.symbols
+                                         if sym.type == 2 and text_section.start_vaddr <= sym.vaddr < text_section.end_vaddr]))
+        self.symbol_set = set(self.symbol_starts)
+        starts = set(np.unique(self.call_targets).tolist())
+        starts.update(self.symbol_starts)
+        starts.add(text_section.start_vaddr)
+        self.fn_start_addrs = sorted(starts)
+        self.text_start = text_section.start_vaddr
+        self.text_end = text_section.end_vaddr
+        Log.info('Call-site index: ' + str(len(self.call_sites)) + ' site(s), ' + str(len(self.fn_start_addrs)) + ' function start(s)')
+
+    # Validates every candidate start, only for callers that need them all
+    def get_fn_start_addrs(self):
+        return [addr for addr in self.fn_start_addrs if self.valid_start(addr)]
+
+    # Whether an instruction starts at addr, decoding from the closest function symbol if it is near, otherwise from
+    # RESYNC_BYTES before addr
+    def is_inst_boundary(self, addr):
+        i = bisect_right(self.symbol_starts, addr) - 1
+        lo = max(self.text_start, addr - RESYNC_BYTES)
+        if i >= 0 and self.symbol_starts[i] >= lo:
+            lo = self.symbol_starts[i]
+        code = self.binary.read_bytes(lo, min(addr + MAX_INST_SIZE, self.text_end) - lo)
+        for inst in self.binary.get_capstone().disasm(bytearray(code), lo):
+            if inst.address >= addr:
+                return inst.address == addr
+        return False
+
+    # A call target is a function start if it decodes as an instruction and one of its e8 sites decodes as a call:
+    # an e8 byte inside another instruction, or a target in the middle of one, would split the function around it
+    # Function symbols and the start of .text are always starts
+    def valid_start(self, addr):
+        if addr not in self.valid_starts:
+            if addr == self.text_start or addr in self.symbol_set:
+                valid = True
+            else:
+                lo = np.searchsorted(self.call_targets, addr, side='left')
+                hi = np.searchsorted(self.call_targets, addr, side='right')
+                valid = self.is_inst_boundary(addr) and any([self.is_inst_boundary(site) for site in self.call_sites[lo:hi].tolist()])
+                if not valid:
+                    Log.debug('Rejected function start: %#x', addr)
+            self.valid_starts[addr] = valid
+        return self.valid_starts[addr]
+
+    def footprints(self):
+        out = {'call-site index': [self.call_sites, self.call_targets], 'function starts': self.fn_start_addrs,
+               'recovered functions': self.recovered, 'validated starts': self.valid_starts}
+        if self.simple_ca is not None:
+            out.update(self.simple_ca.footprints())
+        return out
+
+    # The project is being dropped (Binary.release_transient): functions recovered in its kb are gone with it,
+    # so they are recovered again in the next project when queried
+    def release_angr(self):
+        self.recovered = {}
+
+    def get_func_scope(self, vaddr):
+        i = bisect_right(self.fn_start_addrs, vaddr) - 1
+        while i > 0 and not self.valid_start(self.fn_start_addrs[i]):
+            i -= 1
+        j = i + 1
+        while j < len(self.fn_start_addrs) and not self.valid_start(self.fn_start_addrs[j]):
+            j += 1
+        entry_addr = self.fn_start_addrs[i]
+        exit_addr = self.fn_start_addrs[j] if j < len(self.fn_start_addrs) else self.text_end
+        return entry_addr, exit_addr
+
+    # CFGFast restricted to one function; returns the set of its instruction addresses
+    # Other functions CFGFast finds in the region (e.g. jmp targets) only end the blocks of this one, they are not
+    # added as function starts
+    def recover_function(self, entry):
+        if entry in self.recovered:
+            return self.recovered[entry]
+        _, exit_addr = self.get_func_scope(entry)
+        inst_addrs = set()
+        try:
+            cfg = self.binary.angr_proj.analyses.CFGFast(regions=[(entry, exit_addr)], function_starts=[entry], start_at_entry=False,
+                                                         symbols=False, function_prologues=False, force_complete_scan=False)
+            fn = cfg.kb.functions.get(entry)
+            if fn is not None:
+                for bb in fn.blocks:
+                    inst_addrs.update(bb.instruction_addrs)
+        except Exception as e:
+            Log.warning('Region CFG failed at ' + hex(entry) + ': ' + str(e))
+        if not inst_addrs:
+            inst_addrs = set([inst.address for inst in self.binary.disasm(entry, exit_addr)])
+        self.recovered[entry] = inst_addrs
+        return inst_addrs
+
+    def code_refs(self, vaddr):
+        # Who is calling ``vaddr"
+        lo = np.searchsorted(self.call_targets, vaddr, side='left')
+        hi = np.searchsorted(self.call_targets, vaddr, side='right')
+        out = []
+        for site in self.call_sites[lo:hi].tolist():
+            caller_start, _ = self.get_func_scope(site)
+            if site in self.recover_function(caller_start):
+                out.append(site)
+        return out
+
+    def function_callers(self, fn_start):
+        return list(set([self.get_func_scope(site)[0] for site in self.code_refs(fn_start)]))
+
+    def data_refs(self, start_vaddr, end_vaddr=None):
+        if self.simple_ca is None:
+            self.simple_ca = CallerAnalysis(self.binary)
+        return self.simple_ca.data_refs(start_vaddr, end_vaddr)
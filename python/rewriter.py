@@ -3,7 +3,9 @@ from expand_local_buffer import *
 import subprocess
 import collections
 import os
+import struct
 from alice_logger import RewriterLog
+from alice_trace import TRACER
 
 Log = RewriterLog
 
@@ -20,18 +22,114 @@ class NewCryptoPatch:
 
 class NewDataPatch:
 
-    def __init__(self, addr, old_size, new_size):
+    # init_data: original contents of a .data object, None for a .bss object (zero-initialized)
+    def __init__(self, addr, old_size, new_size, init_data=None):
         self.old_addr = addr
         self.new_addr = None 
         self.old_size = old_size
         self.new_size = new_size
+        self.init_data = init_data
+
+    def get_blob(self):
+        init_data = self.init_data if self.init_data is not None else ''
+        return init_data + '\00'*(self.new_size-len(init_data))
+
+PT_LOAD = 1
+PF_W = 2
+
+# Return [(file offset of program header, p_vaddr, p_memsz, p_flags)] of all PT_LOAD segments of an ELF64 file
+def load_segments(path):
+    out = []
+    with open(path, 'rb') as f:
+        ehdr = f.read(64)
+        if ehdr[:4] != '\x7fELF' or ord(ehdr[4]) != 2:
+            raise RewriteError('Not an ELF64 file: ' + path)
+        phoff, = struct.unpack('<Q', ehdr[0x20:0x28])
+        phentsize, phnum = struct.unpack('<HH', ehdr[0x36:0x3a])
+        for i in range(phnum):
+            f.seek(phoff + i*phentsize)
+            p_type, p_flags, _, p_vaddr, _, _, p_memsz, _ = struct.unpack('<IIQQQQQQ', f.read(56))
+            if p_type == PT_LOAD:
+                out.append((phoff + i*phentsize, p_vaddr, p_memsz, p_flags))
+    return out
+
+# End address of the writable segment holding .bss; memory past it is free for zero-fill relocation
+def bss_segment_end(path):
+    ends = [vaddr+memsz for _, vaddr, memsz, flags in load_segments(path) if flags & PF_W]
+    return max(ends) if ends else None
+
+# Grow p_memsz (but not p_filesz) of the segment ending at seg_end, the loader zero-fills the extra bytes
+def extend_bss_segment(path, seg_end, extra_size):
+    for phdr_off, vaddr, memsz, _ in load_segments(path):
+        if vaddr < seg_end + extra_size and vaddr + memsz > seg_end:
+            raise RewriteError('Segment at: ' + hex(vaddr) + ' overlaps zero-fill area ' + hex(seg_end) + '-' + hex(seg_end+extra_size))
+
+    for phdr_off, vaddr, memsz, _ in load_segments(path):
+        if vaddr + memsz == seg_end:
+            with open(path, 'r+b') as f:
+                f.seek(phdr_off + 0x28)
+                f.write(struct.pack('<Q', memsz + extra_size))
+            return
+    raise RewriteError('No segment ends at: ' + hex(seg_end))
+
+# Pack all injected code into one contiguous region and all injected data into another one,
+# instead of injecting every blob separately (each injected region can cost its own page fault/iTLB entry)
+# The data region is injected first, so its addresses do not depend on the code injected after it
+class CodeCavePlacement:
+    ALIGN = 16
+
+    def __init__(self):
+        self.code = []
+        self.data = []
+        self.regions = []
+
+    # Hot blobs are placed first, right after the original code
+    def add_code(self, key, blob, hot=False):
+        self.code.append((not hot, len(self.code), key, blob))
+
+    def add_data(self, key, blob):
+        self.data.append((False, len(self.data), key, blob))
+
+    # Inject both regions, return {key: absolute address}
+    def place(self, patchset):
+        addrs = {}
+        for name, blobs in [('data', self.data), ('code', self.code)]:
+            if not blobs:
+                continue
+            region = ''
+            offsets = []
+            for _, _, key, blob in sorted(blobs):
+                region += '\00'*(-len(region) % self.ALIGN)
+                offsets.append((key, len(region)))
+                region += blob
+
+            base = patchset.inject(raw=region)
+            self.regions.append((base, len(region)))
+            for key, offset in offsets:
+                addrs[key] = base + offset
+
+            payload = sum([len(blob) for _, _, _, blob in blobs])
+            Log.info('Placement: ' + name + ' region at ' + hex(base) + ' size: ' + hex(len(region)) + ' (' + str(len(blobs)) + ' blob(s), ' + str(len(region)-payload) + ' padding byte(s))')
+        return addrs
 
 class Rewriter:
-    def __init__(self, exec_path):
+    # in_place: patch modified instructions of an ExpandLocalBufferPatch where they are,
+    # and only relocate the function if some instruction does not fit its original encoding
+    # zero_fill: place expanded .bss objects past the end of .bss by growing its segment in memory only,
+    # so they take no room in the file (.data objects are still injected with their initial contents)
+    def __init__(self, exec_path, in_place=True, zero_fill=True):
         self.path = exec_path
         self.patcher = Patcher(self.path)
         self.patches = []
         self.data_patches = []
+        self.in_place = in_place
+        self.in_place_encodings = {}
+        self.data_plan = None
+        self.zero_fill = zero_fill
+        self.zero_fill_size = 0
+        self.bss_end = bss_segment_end(self.path) if zero_fill else None
+        if self.bss_end is None:
+            self.zero_fill = False
 
     def add_patch(self, patch):
         if isinstance(patch, NewDataPatch):
@@ -43,16 +141,30 @@ class Rewriter:
         for patch in patches:
             self.add_patch(patch)
     
+    # Run the dummy passes on the patches added so far and return {old addr: new addr} of the data patches
+    # ExpandLocalBufferPatches refer to the new addresses, so they are generated from this mapping and added afterwards;
+    # later passes check that the data patches stay where they were planned
+    def plan_data(self):
+        Log.debug('Planning data placement')
+        for _ in range(2):
+            with TRACER.span('rewriter pass', 'rewriter', deploy=False):
+                self._apply_patches(False)
+        self.data_plan = dict([(patch, patch.new_addr) for patch in self.data_patches])
+        return dict([(patch.old_addr, patch.new_addr) for patch in self.data_patches])
+
     def apply_patches(self):
         Log.debug('------------------------------------------------------')
         Log.debug('Applying dummy patch to determine final locations')
-        self._apply_patches(False)
+        with TRACER.span('rewriter pass', 'rewriter', deploy=False):
+            self._apply_patches(False)
         Log.debug('------------------------------------------------------')
         Log.debug('----------- Again just in case -----------')
-        self._apply_patches(False)
+        with TRACER.span('rewriter pass', 'rewriter', deploy=False):
+            self._apply_patches(False)
         Log.debug('------------------------------------------------------')
         Log.debug('Now applying real patch')
-        self._apply_patches(True)
+        with TRACER.span('rewriter pass', 'rewriter', deploy=True):
+            self._apply_patches(True)
 
     def _apply_patches(self, deploy):
         if deploy:
@@ -60,42 +172,89 @@ class Rewriter:
         else:
             dummy = Patcher(self.path)
 
-        out_data_patches = []
+        # Gather every blob first, then inject them as one code region and one data region
+        placement = CodeCavePlacement()
+        self.zero_fill_size = 0
         for patch in self.data_patches:
-            init_data = ''
-            for i in range(0, patch.new_size):
-                init_data += '\00'
-            with dummy.bin.collect() as patchset:
-                patch.new_addr = patchset.inject(raw=init_data)
-            out_data_patches.append(patch)
-        self.data_patches = out_data_patches
-
-        out_patches = []
+            if self.zero_fill and patch.init_data is None:
+                self.zero_fill_size += -self.zero_fill_size % CodeCavePlacement.ALIGN
+                patch.new_addr = self.bss_end + self.zero_fill_size
+                self.zero_fill_size += patch.new_size
+            else:
+                placement.add_data(patch, patch.get_blob())
+
         for patch in self.patches:
             if isinstance(patch, NewCryptoPatch):
                 self._run_script(patch.patch_desc.patch_dir, patch.patch_desc.script_name, \
                     hex(patch.data_addr), hex(patch.code_addr), hex(patch.entry_addr), patch.patch_desc.data_name, \
                     patch.patch_desc.code_name, patch.entry_name)
-                with dummy.bin.collect() as patchset:
-                    patch.data_addr = self._inject_exec(patchset, patch.patch_desc.patch_dir, patch.patch_desc.data_name)
-                    patch.code_addr = self._inject_exec(patchset, patch.patch_desc.patch_dir, patch.patch_desc.code_name)
-                    patch.entry_addr = self._inject_exec(patchset, patch.patch_desc.patch_dir, patch.entry_name)
-                    patchset.patch(patch.old_entry_pt, jmp=patch.entry_addr)
+                placement.add_data((patch, 'data'), self._read_blob(patch.patch_desc.patch_dir, patch.patch_desc.data_name))
+                placement.add_code((patch, 'code'), self._read_blob(patch.patch_desc.patch_dir, patch.patch_desc.code_name))
+                placement.add_code((patch, 'entry'), self._read_blob(patch.patch_desc.patch_dir, patch.entry_name))
+            elif isinstance(patch, ExpandLocalBufferPatch) and self._in_place_encoding(patch) is not None:
+                continue
             elif isinstance(patch, ExpandLocalBufferPatch):
                 patch.rewrite(patch.start_addr)
                 patch.print_asm()
-                nops = ''
-                for i in range(patch.elb.start_vaddr+4, patch.elb.end_vaddr):
-                    nops += 'nop\n'
-                with dummy.bin.collect() as patchset:
-                    patch.start_addr = patchset.inject(raw=patch.compile())
+                # Relocated functions are hot, keep them first so they stay within rel32 reach of .text
+                placement.add_code(patch, str(patch.compile()), hot=True)
+            else:
+                raise NotImplementedError('No record for patch: ' + patch)
+
+        with dummy.bin.collect() as patchset:
+            addrs = placement.place(patchset)
+            self._check_zero_fill(placement, deploy)
+
+            for patch in self.data_patches:
+                if patch in addrs:
+                    patch.new_addr = addrs[patch]
+                if self.data_plan is not None and patch.new_addr != self.data_plan[patch]:
+                    raise RewriteError('Data at: ' + hex(patch.old_addr) + ' moved from planned ' + hex(self.data_plan[patch]) + ' to ' + hex(patch.new_addr))
+
+            for patch in self.patches:
+                if isinstance(patch, NewCryptoPatch):
+                    patch.data_addr = addrs[(patch, 'data')]
+                    patch.code_addr = addrs[(patch, 'code')]
+                    patch.entry_addr = addrs[(patch, 'entry')]
+                    patchset.patch(patch.old_entry_pt, jmp=patch.entry_addr)
+                elif self._in_place_encoding(patch) is not None:
+                    for addr, encoding in sorted(self._in_place_encoding(patch).items()):
+                        patchset.patch(addr, raw=encoding)
+                else:
+                    patch.start_addr = addrs[patch]
+                    if abs(patch.start_addr - patch.elb.start_vaddr) >= (1 << 31):
+                        Log.warning('Relocated function at: ' + hex(patch.start_addr) + ' is out of rel32 range from ' + hex(patch.elb.start_vaddr))
+                    nops = ''
+                    for i in range(patch.elb.start_vaddr+4, patch.elb.end_vaddr):
+                        nops += 'nop\n'
                     patchset.patch(patch.elb.start_vaddr+4, asm=nops)
                     patchset.patch(patch.elb.start_vaddr, jmp=patch.start_addr)
+
+    # Injected regions must not land in the zero-fill area. If they do, fall back to file-backed
+    # data for the next pass (dummy passes always run before the real one)
+    # The decision is only taken by the plan_data passes: once the data mapping is handed out it cannot change
+    def _check_zero_fill(self, placement, deploy):
+        if self.zero_fill_size == 0:
+            return
+        Log.info('Zero-fill: ' + hex(self.zero_fill_size) + ' byte(s) at ' + hex(self.bss_end))
+        for base, size in placement.regions:
+            if base < self.bss_end + self.zero_fill_size and base + size > self.bss_end:
+                if deploy or self.data_plan is not None:
+                    raise RewriteError('Injected region at: ' + hex(base) + ' overlaps zero-fill area')
+                Log.warning('Injected region at: ' + hex(base) + ' overlaps zero-fill area, injecting .bss objects instead')
+                self.zero_fill = False
+
+    # Encoding is computed once and reused across the dummy and real passes
+    def _in_place_encoding(self, patch):
+        if patch not in self.in_place_encodings:
+            encoding = patch.rewrite_in_place() if self.in_place else None
+            if encoding is None:
+                Log.info('Relocating function at: ' + hex(patch.elb.start_vaddr))
             else:
-                raise NotImplementedError('No record for patch: ' + patch)
-            out_patches.append(patch)
-        self.patches = out_patches
-                             
+                Log.info('Rewriting function in place at: ' + hex(patch.elb.start_vaddr) + ' (' + str(len(encoding)) + ' inst(s))')
+            self.in_place_encodings[patch] = encoding
+        return self.in_place_encodings[patch]
+
     def _run_script(self, script_dir, script_name, *script_args):
         pwd = os.getcwd()
         os.chdir(script_dir)
@@ -106,13 +265,13 @@ class Rewriter:
         Log.debug('Script output: ' + popen.stdout.read())
         os.chdir(pwd)
 
-    def _inject_exec(self, pt, base_dir, file_name):
+    def _read_blob(self, base_dir, file_name):
         with open(os.path.join(base_dir, file_name), "rb") as f:
-            binary = f.read()
-            addr = pt.inject(raw=binary)
-        return addr
+            return f.read()
 
     def save(self, path):
         self.patcher.save(path)
+        if self.zero_fill and self.zero_fill_size > 0:
+            extend_bss_segment(path, self.bss_end, self.zero_fill_size)
 
 
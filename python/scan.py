@@ -0,0 +1,181 @@
+#!/usr/bin/env python2
+# Detection-only scan: report which crypto primitives (desc.py) a set of binaries contain, and where,
+# without building angr projects or CFGs. Every ELF is mmapped, and .text/.rodata are searched with one
+# Aho-Corasick automaton holding the constants of all descriptors. One JSON line is written per binary.
+#
+# Usage: python scan.py [-j N] [--crypto md5,sha1,des,rc2] [--out report.jsonl] [--all-hits] PATH [PATH ...]
+#   PATH: ELF files or directories (walked recursively, symlinks skipped)
+import os
+import sys
+import json
+import time
+import struct
+import argparse
+import multiprocessing
+import ahocorasick
+from desc import KnownCryptoDesc
+from elf_loader import ElfFile, ElfFormatError, SHT_NOBITS
+
+TEXT = '.text'
+RODATA = '.rodata'
+ET_EXEC = 2
+ET_DYN = 3
+
+# A .text match counts if all whitelisted constants (and no blacklisted one) fall within this many bytes,
+# the section-level counterpart of FastLocator._locate_bb_level which checks whole basic blocks
+TEXT_WINDOW = 256
+
+
+class FleetScanner:
+
+    def __init__(self, cryptos, window=TEXT_WINDOW):
+        self.cryptos = cryptos
+        self.window = window
+        # pattern bytes -> [(crypto name, role)]
+        self.patterns = {}
+        for c in cryptos:
+            for role, hexs in (('text_contain', c.text_contain), ('text_not_contain', c.text_not_contain),
+                               ('rodata_contain', c.rodata_contain)):
+                for h in hexs:
+                    self.patterns.setdefault(h.decode('hex'), []).append((c.name, role))
+        self.auto = ahocorasick.Automaton()
+        for p in self.patterns:
+            self.auto.add_word(p, p)
+        self.auto.make_automaton()
+
+    # {pattern: [vaddr]} of one section
+    def _search(self, elf, section_name):
+        sec = elf.sections_map.get(section_name)
+        if sec is None or sec.type == SHT_NOBITS or not sec.memsize:
+            return {}
+        hits = {}
+        for end_ind, p in self.auto.iter(elf.data[sec.offset:sec.offset + sec.memsize]):
+            hits.setdefault(p, []).append(sec.vaddr + end_ind - len(p) + 1)
+        return hits
+
+    def _text_matches(self, c, text_hits):
+        wl = [h.decode('hex') for h in c.text_contain]
+        bl = [h.decode('hex') for h in c.text_not_contain]
+        if not all([p in text_hits for p in wl]):
+            return []
+        out = []
+        # Anchor windows on the rarest whitelisted constant
+        anchor = min(wl, key=lambda p: len(text_hits[p]))
+        for addr in text_hits[anchor]:
+            lo, hi = addr - self.window, addr + self.window
+            if all([any([lo <= a <= hi for a in text_hits[p]]) for p in wl]) and \
+                    not any([any([lo <= a <= hi for a in text_hits.get(p, [])]) for p in bl]):
+                out.append(addr)
+        return out
+
+    def scan_file(self, path, all_hits=False):
+        start = time.time()
+        out = {'path': path}
+        try:
+            elf = ElfFile(path)
+        except ElfFormatError as e:
+            out['error'] = str(e)
+            return out
+        try:
+            text_hits = self._search(elf, TEXT)
+            rodata_hits = self._search(elf, RODATA)
+        finally:
+            elf.close()
+
+        found = []
+        for c in self.cryptos:
+            if c.text_contain:
+                for addr in self._text_matches(c, text_hits):
+                    found.append({'crypto': c.name, 'section': TEXT, 'addr': addr})
+            if c.rodata_contain:
+                rodata = [h.decode('hex') for h in c.rodata_contain]
+                if all([p in rodata_hits for p in rodata]):
+                    for p in rodata:
+                        for addr in rodata_hits[p]:
+                            found.append({'crypto': c.name, 'section': RODATA, 'addr': addr})
+        out['found'] = found
+        out['cryptos'] = sorted(set([f['crypto'] for f in found]))
+        if all_hits:
+            out['hits'] = [{'pattern': p.encode('hex'), 'section': s, 'addrs': addrs}
+                           for s, hits in ((TEXT, text_hits), (RODATA, rodata_hits)) for p, addrs in hits.items()]
+        out['time'] = time.time() - start
+        return out
+
+
+def iter_paths(paths):
+    for path in paths:
+        if os.path.isfile(path):
+            yield path
+            continue
+        for root, dirs, files in os.walk(path):
+            for name in files:
+                p = os.path.join(root, name)
+                if not os.path.islink(p) and os.path.isfile(p):
+                    yield p
+
+# Executables and shared objects only (relocatable objects have no load segments)
+def is_elf(path):
+    try:
+        with open(path, 'rb') as f:
+            head = f.read(18)
+    except IOError:
+        return False
+    return len(head) == 18 and head[:4] == '\x7fELF' and struct.unpack_from('<H', head, 16)[0] in (ET_EXEC, ET_DYN)
+
+
+# Pool workers: one automaton per process, built once
+_scanner = None
+_all_hits = False
+
+def _init_worker(crypto_names, all_hits):
+    global _scanner, _all_hits
+    _scanner = FleetScanner([c for c in KnownCryptoDesc if c.name in crypto_names])
+    _all_hits = all_hits
+
+def _scan(path):
+    if not is_elf(path):
+        return None
+    try:
+        return _scanner.scan_file(path, _all_hits)
+    except Exception as e:
+        return {'path': path, 'error': str(e)}
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Detection-only scan of ELF binaries for crypto primitives')
+    parser.add_argument('paths', nargs='+')
+    parser.add_argument('-j', '--jobs', type=int, default=multiprocessing.cpu_count())
+    parser.add_argument('--crypto', default=','.join([c.name for c in KnownCryptoDesc]), help='comma-separated descriptor names')
+    parser.add_argument('--out', default=None, help='JSON-lines report (default: stdout)')
+    parser.add_argument('--all-hits', action='store_true', help='also report raw constant hits')
+    args = parser.parse_args()
+
+    names = args.crypto.split(',')
+    unknown = set(names) - set([c.name for c in KnownCryptoDesc])
+    if unknown:
+        parser.error('unknown crypto: ' + ', '.join(sorted(unknown)))
+
+    out = open(args.out, 'w') if args.out else sys.stdout
+    pool = multiprocessing.Pool(args.jobs, _init_worker, (names, args.all_hits))
+    start = time.time()
+    count = 0
+    positive = 0
+    try:
+        for res in pool.imap_unordered(_scan, iter_paths(args.paths), chunksize=16):
+            if res is None:
+                continue
+            count += 1
+            positive += 1 if res.get('found') else 0
+            out.write(json.dumps(res, sort_keys=True) + '\n')
+            out.flush()
+    finally:
+        pool.close()
+        pool.join()
+        if out is not sys.stdout:
+            out.close()
+    sys.stderr.write('Scanned %d ELF file(s) in %.1fs, %d with crypto constants\n' % (count, time.time() - start, positive))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -24,7 +24,8 @@ class CryptoScope:
 
     def __init__(self, exec_path):
         self.locator = CryptoLocator(exec_path)
-        self.proj = angr.Project(exec_path)
+        # Share the locator's project instead of loading the binary again
+        self.proj = self.locator.proj
         self.__call_inst_addrs = self._get_call_inst_addrs()
         self.__lea_inst_addrs = self._get_lea_inst_addrs()
         self.reset_checked_entries()
@@ -133,8 +133,10 @@ def aggrMem(tainted_mems, min_size=0):
             stack.append(mem)
         elif isinstance(mem, HeapMem):
             heap.append(mem)
-        elif isinstance(mem, DataMem) or isinstance(mem, BSSMem):
+        elif isinstance(mem, DataMem):
             data.append(mem)
+        elif isinstance(mem, BSSMem):
+            bss.append(mem)
         elif isinstance(mem, InputMem):
             inp.append(mem)
         else:
@@ -208,6 +210,38 @@ def aggrFromAddrs(addrs, memType, min_cont_size, fn_addr=None):
             aggrMems.append(AggrMem(addr[0], len(addr), memType, fn_addr))
     return aggrMems
 
+
+# Merge the AggrMems found by several scoping runs ({input index: set of AggrMem})
+# Regions of the same type and function that overlap but disagree (different start or size) are merged into
+# the smallest region covering all of them, so the rewrite expands enough for every input
+# Returns (merged AggrMems, [(merged AggrMem, [(input index, AggrMem)])] for each conflict)
+def mergeAggrMems(mem_sets):
+    sources = {}
+    for i, mems in mem_sets.items():
+        for mem in mems:
+            sources.setdefault(mem, []).append(i)
+
+    merged = []
+    conflicts = []
+    keyfn = lambda m: (m.type, m.fn_addr)
+    mems = sorted(sources.keys(), key=lambda m: (keyfn(m), m.addr, m.size))
+    for _, group in groupby(mems, keyfn):
+        cur = []
+        end = None
+        for mem in list(group) + [None]:
+            if mem is not None and cur and mem.addr < end:
+                cur.append(mem)
+                end = max(end, mem.addr + mem.size)
+                continue
+            if cur:
+                region = AggrMem(cur[0].addr, end - cur[0].addr, cur[0].type, cur[0].fn_addr)
+                merged.append(region)
+                if len(cur) > 1:
+                    conflicts.append((region, [(i, m) for m in cur for i in sources[m]]))
+            if mem is not None:
+                cur = [mem]
+                end = mem.addr + mem.size
+    return merged, conflicts
     
      
 if __name__ == '__main__':
@@ -215,5 +249,6 @@ if __name__ == '__main__':
     addrs.extend([300+x for x in range(0,10)])
     addrs.extend([500+x for x in range(0,16)])
     print aggrFromAddrs(addrs, 'Stack', 16)
+    print mergeAggrMems({0: set([AggrMem(100, 16, 'Stack', 0x400000)]), 1: set([AggrMem(100, 20, 'Stack', 0x400000)])})
 
 
@@ -2,6 +2,7 @@
 from triton import *
 from pintool import *
 import sys
+import os
 import angr
 import string
 
@@ -106,8 +107,9 @@ def update_taint(inst):
         # Differentiate between stack memory, statically allocated memory (in data section) and dynamically allocated memory (in heap)
         new_tainted_mem = set([getTaintedMem(x, call_stack, ip) for x in diff_mem])
 
+        # Stack buffers, and statically allocated ones (.bss/.data) the rewriter moves to a larger location
         for tm in new_tainted_mem:
-            if isinstance(tm, StackMem):
+            if isinstance(tm, (StackMem, BSSMem, DataMem)):
 
         #if len(new_tainted_mem) > 0:
                 Log.debug('New Taint: ' + str(tm) + 'at inst addr: ' + hex(ip))
@@ -260,7 +262,7 @@ def fini():
     print aggr_mems
     stack_mems = []
     for amem in aggr_mems:
-        if 'Stack' in str(amem):
+        if amem.type in ('Stack', 'BSS', 'Data'):
             Log.debug('Aggr: '+str(amem))
             print 'Aggr: '+str(amem)
             stack_mems.append(amem)
@@ -280,7 +282,8 @@ if __name__ == '__main__':
 
     import pickle
     print 'Starting!'
-    out_dir = './out/scope/'
+    # alice.py gives every run its own directory, default to the old shared one
+    out_dir = os.environ.get('ALICE_SCOPE_DIR', './out/scope/')
     with open(out_dir+'fn.out', 'r') as f:
         file_name = f.read()
 
@@ -0,0 +1,94 @@
+# Rewriting of statically allocated buffers (NewDataPatch): expanded .bss objects go to the zero-fill area past the
+# end of their segment, expanded .data objects are injected with their initial contents
+# Run from python/: python -m unittest discover -s tests
+import os
+import sys
+import shutil
+import tempfile
+import unittest
+import subprocess
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+from elf_loader import ElfFile
+
+try:
+    from rewriter import Rewriter, NewDataPatch, PF_W
+    IMPORT_ERROR = None
+except ImportError as e:
+    IMPORT_ERROR = str(e)
+
+SOURCE = r'''
+char bss_buf[16];
+char data_buf[16] = "0123456789abcdef";
+int main(void) { return bss_buf[0] + data_buf[0]; }
+'''
+
+OLD_SIZE = 16
+NEW_SIZE = 64
+
+
+def writable_segment(elf):
+    return max([seg for seg in elf.load_segments if seg.flags & PF_W], key=lambda seg: seg.vaddr + seg.memsz)
+
+
+@unittest.skipIf(IMPORT_ERROR is not None, 'rewriter dependencies missing: %s' % IMPORT_ERROR)
+class StaticRewriteTest(unittest.TestCase):
+
+    def setUp(self):
+        self.tmp = tempfile.mkdtemp()
+        self.path = os.path.join(self.tmp, 'static_buffers')
+        src = self.path + '.c'
+        with open(src, 'w') as f:
+            f.write(SOURCE)
+        try:
+            subprocess.check_call(['gcc', '-O0', '-no-pie', '-o', self.path, src])
+        except (OSError, subprocess.CalledProcessError) as e:
+            self.skipTest('cannot build test binary: %s' % e)
+        self.elf = ElfFile(self.path)
+
+    def tearDown(self):
+        self.elf.close()
+        shutil.rmtree(self.tmp)
+
+    def rewrite(self, patch):
+        rewriter = Rewriter(self.path)
+        rewriter.add_patch(patch)
+        mapping = rewriter.plan_data()
+        rewriter.apply_patches()
+        out_path = self.path + '-patched'
+        rewriter.save(out_path)
+        return mapping[patch.old_addr], out_path
+
+    def test_bss_buffer_is_zero_filled(self):
+        bss_buf = self.elf.get_symbol('bss_buf')
+        old_seg = writable_segment(self.elf)
+        new_addr, out_path = self.rewrite(NewDataPatch(bss_buf.vaddr, OLD_SIZE, NEW_SIZE))
+
+        out = ElfFile(out_path)
+        try:
+            new_seg = writable_segment(out)
+            self.assertEqual(new_addr, old_seg.vaddr + old_seg.memsz)
+            self.assertEqual(new_seg.memsz, old_seg.memsz + NEW_SIZE)
+            self.assertEqual(new_seg.filesz, old_seg.filesz)
+            self.assertEqual(os.path.getsize(out_path), os.path.getsize(self.path))
+            self.assertEqual(out.read_bytes(new_addr, NEW_SIZE), '\0' * NEW_SIZE)
+        finally:
+            out.close()
+
+    def test_data_buffer_contents_are_copied(self):
+        data_buf = self.elf.get_symbol('data_buf')
+        init_data = self.elf.read_bytes(data_buf.vaddr, OLD_SIZE)
+        self.assertEqual(init_data, '0123456789abcdef')
+        new_addr, out_path = self.rewrite(NewDataPatch(data_buf.vaddr, OLD_SIZE, NEW_SIZE, init_data))
+
+        out = ElfFile(out_path)
+        try:
+            self.assertNotEqual(new_addr, data_buf.vaddr)
+            self.assertEqual(out.read_bytes(new_addr, NEW_SIZE), init_data + '\0' * (NEW_SIZE - OLD_SIZE))
+            self.assertEqual(writable_segment(out).memsz, writable_segment(self.elf).memsz)
+        finally:
+            out.close()
+
+
+if __name__ == '__main__':
+    unittest.main()
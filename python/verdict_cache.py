@@ -0,0 +1,119 @@
+import os
+import json
+import hashlib
+from capstone.x86 import *
+from artifact_store import ALICE_VERSION, desc_set_hash, atomic_write
+from alice_logger import AliceLog
+
+Log = AliceLog['main']
+
+# Bytes of a referenced data object that go into the fingerprint (enough to tell constant tables apart)
+REF_BYTES = 64
+
+# Position-independent text of an instruction: branch targets, RIP-relative displacements and
+# absolute addresses inside the binary are masked, everything else (opcodes, registers, constants) is kept
+# Masked data references are replaced by the bytes they point to (referenced(addr)), so the same code using
+# different constant tables does not get the same fingerprint
+def normalize_inst(inst, min_addr, max_addr, referenced=lambda addr: ''):
+    ops = []
+    for op in inst.operands:
+        if op.type == X86_OP_IMM:
+            if inst.group(X86_GRP_JUMP) or inst.group(X86_GRP_CALL):
+                ops.append('i:ADDR')
+            elif min_addr <= op.imm < max_addr:
+                ops.append('i:ADDR=' + referenced(op.imm))
+            else:
+                ops.append('i:%x' % op.imm)
+        elif op.type == X86_OP_MEM:
+            if op.mem.base == X86_REG_RIP:
+                disp = 'RIP=' + referenced(inst.address + inst.size + op.mem.disp)
+            elif min_addr <= op.mem.disp < max_addr:
+                disp = 'ADDR=' + referenced(op.mem.disp)
+            else:
+                disp = '%x' % op.mem.disp
+            ops.append('m:%d:%d:%d:%d:%s' % (op.mem.segment, op.mem.base, op.mem.index, op.mem.scale, disp))
+        elif op.type == X86_OP_REG:
+            ops.append('r:%d' % op.reg)
+    return inst.mnemonic + ' ' + ','.join(ops)
+
+
+# Persistent asserter verdicts shared across binaries, e.g. gnulib md5_process_block or curl's body()
+# recurring in different builds. Keyed by a fingerprint of the candidate's normalized code
+# (and its direct callees, up to CALLEE_DEPTH) plus the crypto descriptor it was tested against and the asserter
+# backend that ran it (emulated and native runs can disagree, e.g. on code the emulator stubs out).
+# Layout: <root>/<fp[:2]>/<fp>/<crypto key>/<signature>.json = {'pass': bool, 'out_index': int}
+# One file per verdict, written atomically: concurrent detect processes never rewrite each other's entries
+class VerdictCache:
+    CALLEE_DEPTH = 2
+
+    def __init__(self, root, binary, backend='emulated'):
+        self.root = root
+        self.binary = binary
+        self.backend = backend
+        self.fingerprints = {}
+        self.hits = 0
+        self.misses = 0
+
+    def fingerprint(self, entry, depth=None):
+        if depth is None:
+            depth = self.CALLEE_DEPTH
+        key = (entry, depth)
+        if key in self.fingerprints:
+            return self.fingerprints[key]
+        # Break call cycles
+        self.fingerprints[key] = 'CYCLE'
+
+        try:
+            fn_start, fn_end = self.binary.ca.get_func_scope(entry)
+            insts = self.binary.disasm(entry, fn_end)
+        except Exception as e:
+            # e.g. PLT stubs or the last function of .text, treat as an opaque external
+            Log.debug('Cannot fingerprint %#x: %s', entry, e)
+            self.fingerprints[key] = 'EXTERN'
+            return self.fingerprints[key]
+        # Alignment padding after the last instruction differs between builds
+        while insts and insts[-1].mnemonic.startswith('nop'):
+            insts = insts[:-1]
+
+        h = hashlib.sha256()
+        for inst in insts:
+            h.update(normalize_inst(inst, self.binary.min_addr, self.binary.max_addr, self._referenced) + '\n')
+            if depth > 0 and inst.group(X86_GRP_CALL) and len(inst.operands) == 1 and inst.operands[0].type == X86_OP_IMM:
+                h.update(self.fingerprint(inst.operands[0].imm, depth-1) + '\n')
+
+        self.fingerprints[key] = h.hexdigest()
+        return self.fingerprints[key]
+
+    # Hex of up to REF_BYTES at addr (zeros past the file contents, e.g. .bss), 'UNMAPPED' outside the segments
+    def _referenced(self, addr):
+        seg = self.binary.elf.find_segment(addr)
+        if seg is None:
+            return 'UNMAPPED'
+        return self.binary.read_bytes(addr, min(REF_BYTES, seg.vaddr + seg.memsz - addr)).encode('hex')
+
+    def _crypto_key(self, crypto):
+        return ALICE_VERSION + '-' + self.backend + '-' + crypto.name + '-' + desc_set_hash([crypto])[:16]
+
+    def _path(self, fp, crypto, arg_name):
+        return os.path.join(self.root, fp[:2], fp, self._crypto_key(crypto), arg_name + '.json')
+
+    # Return (pass, out_index) if entry was already classified for crypto/signature, otherwise None
+    def get(self, entry, crypto, arg_name):
+        path = self._path(self.fingerprint(entry), crypto, arg_name)
+        v = None
+        if os.path.exists(path):
+            try:
+                with open(path) as f:
+                    v = json.load(f)
+            except ValueError:
+                pass
+        if v is None:
+            self.misses += 1
+            return None
+        self.hits += 1
+        Log.debug('Verdict cache hit: %#x %s %s -> %s', entry, crypto.name, arg_name, v['pass'])
+        return v['pass'], v['out_index']
+
+    def put(self, entry, crypto, arg_name, passed, out_index):
+        path = self._path(self.fingerprint(entry), crypto, arg_name)
+        atomic_write(path, json.dumps({'pass': passed, 'out_index': out_index}, sort_keys=True))